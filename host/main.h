@@ -0,0 +1,59 @@
+/*
+ * main.h
+ *
+ * Host simulation : stub of the HAL parts shell_pfs.c uses, for building it on a PC (see shell_host.c).
+ * The LED is a variable, the HAL tick and the cycle counter come from the system's monotonic clock
+ * (SystemCoreClock is 1 GHz : one "cycle" per nanosecond).
+ *
+ *  Copyright 2022 Jean Roch
+ *
+ *  This file is part of STM Shell.
+ *
+ *  STM Shell is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  STM Shell is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with STM Shell.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAIN_H_
+#define MAIN_H_
+
+#include <stdint.h>
+
+// GPIO : the LED pin only
+typedef struct
+{
+	uint32_t ODR;		// Output pins
+} GPIO_TypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef host_gpio;
+
+#define LED_GPIO_Port (&host_gpio)
+#define LED_Pin 0x0001
+
+void HAL_GPIO_WritePin (GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state);
+void HAL_GPIO_TogglePin (GPIO_TypeDef* port, uint16_t pin);
+
+// Time
+extern uint32_t SystemCoreClock;
+uint32_t HAL_GetTick (void);
+uint32_t host_cycles (void);
+
+#define SHELL_PFS_CYCLES() host_cycles ()
+
+// Core
+#define __WFI()
+#define __disable_irq()
+#define __enable_irq()
+
+#endif /* MAIN_H_ */
@@ -0,0 +1,54 @@
+/*
+ * shell.h
+ *
+ * Host simulation : the part of the STM Shell library's interface the PFS uses, for building shell_pfs.c
+ * on a PC (see shell_host.c). On target, use the library's own shell.h.
+ *
+ *  Copyright 2022 Jean Roch
+ *
+ *  This file is part of STM Shell.
+ *
+ *  STM Shell is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  STM Shell is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with STM Shell.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHELL_H_
+#define SHELL_H_
+
+#include <stdint.h>
+
+#define SHELL_INPUT_LEN 128		// Command line buffer
+#define SHELL_OUTPUT_LEN 256	// Output buffer (DMA source on target)
+
+// Command block entry : a command (command_fp) or a submenu (block). The first entry of a block is its
+// title, with the number of entries in place of the function pointer (BLOCK_LEN).
+typedef struct s_shell_block_entry
+{
+	char* label;
+	void (*command_fp)();
+	struct s_shell_block_entry* block;
+} t_shell_block_entry;
+
+#define BLOCK_LEN (void (*)())
+#define CMD_BLOCK (t_shell_block_entry*)
+
+typedef struct
+{
+	char input[SHELL_INPUT_LEN];		// Command line (the command's arguments)
+	char output[SHELL_OUTPUT_LEN];		// Text to send
+	volatile int busy;					// Output transfer in progress
+	void (*command_fp)();				// Running command, 0 at the prompt
+} t_shell_state;
+
+extern t_shell_state shell_state;
+extern void (*shell_fp)();				// Current state of the shell's state machine
+
+void shell_state_output ();				// Send shell_state.output, then back to the command or the prompt
+
+#endif /* SHELL_H_ */
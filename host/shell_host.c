@@ -0,0 +1,235 @@
+/*
+ * shell_host.c
+ *
+ * Host simulation : a minimal shell core and HAL stubs, to run the PFS's command tree on a PC.
+ * Reads command lines on stdin and writes the output on stdout, with the same state machine protocol
+ * as the STM Shell library (shell_fp, shell_state.command_fp, shell_state_output), so the commands,
+ * the output queue, the jobs and the benchmarks ("bench") run unmodified. Use it to try commands,
+ * feed the parser with random input, or profile dispatch and formatting (perf, gprof, valgrind).
+ *
+ * Build, from the repository's root :
+ *   gcc -O2 -Wall -Ihost -o shell_host host/shell_host.c shell_pfs.c -Wl,-T,host/shell_pfs.ld
+ * Use :
+ *   ./shell_host                                    interactive
+ *   printf 'led\nflash 3\nbench step\n' | ./shell_host    scripted : ends at the end of the input
+ *   head -c 100000 /dev/urandom | ./shell_host > /dev/null   random input
+ *
+ * At the prompt, a command line is made of submenu names and a command with its arguments ("sm1 load"),
+ * "?" lists the current block and ".." goes back to the parent block.
+ *
+ *  Copyright 2022 Jean Roch
+ *
+ *  This file is part of STM Shell.
+ *
+ *  STM Shell is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  STM Shell is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with STM Shell.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "shell.h"
+#include "main.h"
+#include "../shell_pfs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define HOST_DEPTH 8			// Deepest submenu
+
+/////////////////////////////////////////////////////////////////////////////////////
+// HAL stubs
+/////////////////////////////////////////////////////////////////////////////////////
+
+GPIO_TypeDef host_gpio;
+uint32_t SystemCoreClock = 1000000000;		// 1 "cycle" per nanosecond
+
+void HAL_GPIO_WritePin (GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state)
+{
+	if (state == GPIO_PIN_SET)
+		port->ODR |= pin;
+	else
+		port->ODR &= ~pin;
+}
+
+void HAL_GPIO_TogglePin (GPIO_TypeDef* port, uint16_t pin)
+{
+	port->ODR ^= pin;
+}
+
+static uint64_t host_ns ()
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+uint32_t HAL_GetTick (void)
+{
+	return host_ns () / 1000000;
+}
+
+uint32_t host_cycles (void)
+{
+	return (uint32_t) host_ns ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Shell core : prompt, line input, dispatch, output
+/////////////////////////////////////////////////////////////////////////////////////
+
+t_shell_state shell_state;
+void (*shell_fp)();
+
+static t_shell_block_entry* host_block[HOST_DEPTH] = {(t_shell_block_entry*) root_block};	// Current block and its parents
+static int host_depth = 0;
+static char host_line[SHELL_INPUT_LEN];		// Line being received
+static int host_len = 0;
+static int host_eof = 0;
+
+static void shell_state_prompt ();
+static void shell_state_input ();
+static void shell_state_exec ();
+
+// Entry of the current block whose name (label up to its first space) is the word at "line", 0 if none
+static t_shell_block_entry* host_find (t_shell_block_entry* block, const char* line)
+{
+	int n = (int) (intptr_t) block[0].command_fp;
+	int len, k;
+
+	for (len = 0; (line[len] != 0) && (line[len] != ' '); len++);
+	for (k = 1; k <= n; k++)
+		if ((strncmp (block[k].label, line, len) == 0) && ((block[k].label[len] == 0) || (block[k].label[len] == ' ')))
+			return &block[k];
+
+	return 0;
+}
+
+// Send the output, then back to the command or to the prompt. Output is synchronous : never busy.
+void shell_state_output ()
+{
+	fputs (shell_state.output, stdout);
+	shell_state.output[0] = 0;
+	shell_fp = (shell_state.command_fp != 0) ? shell_state_exec : shell_state_prompt;
+}
+
+static void shell_state_prompt ()
+{
+	printf ("\r\n%s > ", host_block[host_depth][0].label);
+	fflush (stdout);
+	shell_fp = shell_state_input;
+}
+
+// Run a complete line : walk the submenus, then start the command
+static void host_dispatch (char* line)
+{
+	t_shell_block_entry* entry;
+	int k;
+
+	for (;;)
+	{
+		while (*line == ' ')
+			line++;
+		if (*line == 0)
+			break;
+		if (strcmp (line, "..") == 0)
+		{
+			if (host_depth > 0)
+				host_depth--;
+			break;
+		}
+		if (strcmp (line, "?") == 0)
+		{
+			for (k = 1; k <= (int) (intptr_t) host_block[host_depth][0].command_fp; k++)
+				printf ("\r\n%s", host_block[host_depth][k].label);
+			break;
+		}
+
+		entry = host_find (host_block[host_depth], line);
+		if (entry == 0)
+		{
+			printf ("\r\nUnknown command");
+			break;
+		}
+		if (entry->command_fp != 0)
+		{
+			strcpy (shell_state.input, line);
+			shell_state.command_fp = entry->command_fp;
+			shell_fp = shell_state_exec;
+			return;
+		}
+		if ((entry->block != 0) && (host_depth < HOST_DEPTH - 1))
+			host_block[++host_depth] = entry->block;
+		while ((*line != 0) && (*line != ' '))
+			line++;
+	}
+
+	shell_fp = shell_state_prompt;
+}
+
+// Collect characters up to the end of the line. Waits for input as long as the PFS has nothing to do.
+static void shell_state_input ()
+{
+	struct pollfd fd = {0, POLLIN, 0};
+	uint32_t ms = shell_pfs_wait_time ();
+	char c;
+
+	if (host_eof)
+		return;
+	if (poll (&fd, 1, (ms > 1000) ? 1000 : (int) ms) <= 0)
+		return;
+	if (read (0, &c, 1) != 1)
+	{
+		host_eof = 1;
+		return;
+	}
+
+	if ((c == '\r') || (c == '\n'))
+	{
+		host_line[host_len] = 0;
+		host_len = 0;
+		if (!isatty (0))
+			fputs (host_line, stdout);		// echo scripted input, for a readable transcript
+		host_dispatch (host_line);
+	}
+	else if ((c == '\b') || (c == 0x7F))
+	{
+		if (host_len > 0)
+			host_len--;
+	}
+	else if ((c >= ' ') && (host_len < SHELL_INPUT_LEN - 1))
+		host_line[host_len++] = c;
+}
+
+static void shell_state_exec ()
+{
+	if (shell_state.command_fp != 0)
+		shell_state.command_fp ();
+	else
+		shell_fp = shell_state_prompt;
+}
+
+int main ()
+{
+	shell_pfs_init ();
+	shell_fp = shell_state_prompt;
+
+	// Main loop, as on target. Ends with the input, once back at the prompt.
+	while (!host_eof || (shell_fp != shell_state_input))
+	{
+		shell_fp ();
+		shell_pfs_poll ();
+	}
+
+	printf ("\n");
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * shell_pfs_unzip.c
+ *
+ * Host-side decoder for the shell's compressed output ("zip on", see "Compressed output" in shell_pfs.c).
+ *
+ * Reads the shell's output on stdin and writes it to stdout : text passes through, frames are expanded.
+ * Frame : 0x00, COBS (0x5A 0xA5, frame number, LZ length, LZ data, CRC-16 big-endian), 0x00. Each 0x00 may start a
+ * frame : the header is checked as it comes in, and what doesn't start with it is text. A frame ends after its
+ * length, so a lost delimiter costs at most that frame. Frames that fail their CRC are reported on stderr.
+ * Matches may reach into the text of the previous frames (frame number bit 7) : after a bad frame, the frames
+ * that depend on it are reported too, up to the next frame without history.
+ *
+ * Build : gcc -O2 -o shell_pfs_unzip shell_pfs_unzip.c
+ * Use   : shell_pfs_unzip < /dev/ttyACM0   (after setting the port up, e.g. stty -F /dev/ttyACM0 115200 raw)
+ *
+ *  Copyright 2022 Jean Roch
+ *
+ *  This file is part of STM Shell.
+ *
+ *  STM Shell is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  STM Shell is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with STM Shell.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FRAME_MAX 4096		// Larger than any frame for SHELL_PFS_ZIP_BLOCK up to 2048
+#define HEADER 5			// Magic (0x5A 0xA5), frame number, LZ length (big-endian)
+#define WINDOW 256			// History : the longest match distance
+
+static const char class[16] = "0123456789 \r\n:.-";	// Same as zip_class in shell_pfs.c
+
+// CRC-16/CCITT (polynomial 0x1021), same as shell_pfs_crc16
+static uint16_t crc16 (const uint8_t* data, int len, uint16_t crc)
+{
+	int k;
+
+	while (len-- > 0)
+	{
+		crc ^= *data++ << 8;
+		for (k = 0; k < 8; k++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+// Read "bits" bits at bit "pos" of the "len" bytes at "in", MSB first. Returns -1 past the end.
+static int get (const uint8_t* in, int len, int* pos, int bits)
+{
+	int v = 0;
+
+	if (*pos + bits > len * 8)
+		return -1;
+	for (; bits > 0; bits--, (*pos)++)
+		v = (v << 1) | ((in[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+
+	return v;
+}
+
+// LZ decoding (see zip_class in shell_pfs.c) : the data ends where too few bits are left for an item.
+// The text is appended to the "hist" bytes of history at "out". Returns the total length, or -1 if the
+// data is malformed.
+static int lz_decode (const uint8_t* in, int len, uint8_t* out, int hist, int size)
+{
+	int pos = 0, n = hist;
+	int v, dist, mlen;
+
+	while ((v = get (in, len, &pos, 1)) >= 0)
+	{
+		if (v == 0)		// character of the class
+		{
+			if ((v = get (in, len, &pos, 4)) < 0)
+				break;
+			if (n == size)
+				return -1;
+			out[n++] = class[v];
+		}
+		else if ((v = get (in, len, &pos, 1)) < 0)
+			break;
+		else if (v == 0)	// any character
+		{
+			if ((v = get (in, len, &pos, 8)) < 0)
+				break;
+			if (n == size)
+				return -1;
+			out[n++] = v;
+		}
+		else				// match
+		{
+			if (((dist = get (in, len, &pos, 8)) < 0) || ((mlen = get (in, len, &pos, 2)) < 0))
+				break;
+			if (mlen < 3)
+				mlen += 3;
+			else if ((mlen = get (in, len, &pos, 4)) < 0)
+				break;
+			else if (mlen < 15)
+				mlen += 6;
+			else if ((mlen = get (in, len, &pos, 8)) < 0)
+				break;
+			else
+				mlen += 21;
+			dist++;
+			if ((dist > n) || (n + mlen > size))
+				return -1;
+			for (; mlen > 0; mlen--, n++)
+				out[n] = out[n - dist];		// may overlap : byte by byte
+		}
+	}
+
+	return n;
+}
+
+// Expand one frame (decoded, "len" bytes from the magic to the CRC) to stdout
+static void frame (const uint8_t* raw, int len)
+{
+	static uint8_t text[WINDOW + FRAME_MAX];		// History, then the frame's text
+	static int hist = -1;		// Bytes of history, -1 after a bad frame
+	static int last;			// Number of the previous frame
+	int n, num;
+
+	if (crc16 (raw, len - 2, 0xFFFF) != ((raw[len - 2] << 8) | raw[len - 1]))
+	{
+		fprintf (stderr, "\n[bad frame]\n");
+		hist = -1;
+		return;
+	}
+
+	num = raw[2] & 0x7F;
+	if (!(raw[2] & 0x80))
+		hist = 0;		// frame without history
+	else if ((hist < 0) || (num != ((last + 1) & 0x7F)))
+	{
+		fprintf (stderr, "\n[frame lost]\n");
+		hist = -1;
+		return;
+	}
+	last = num;
+
+	n = lz_decode (&raw[HEADER], len - HEADER - 2, text, hist, sizeof (text));
+	if (n < 0)
+	{
+		fprintf (stderr, "\n[bad data]\n");
+		hist = -1;
+		return;
+	}
+
+	fwrite (&text[hist], 1, n - hist, stdout);
+
+	// Keep the end of the text as the next frame's history
+	hist = (n < WINDOW) ? n : WINDOW;
+	memmove (text, &text[n - hist], hist);
+}
+
+// Non-zero while the first "n" decoded bytes may start a frame
+static int header_ok (const uint8_t* raw, int n)
+{
+	return ((n < 1) || (raw[0] == 0x5A)) && ((n < 2) || (raw[1] == 0xA5))
+		&& ((n < HEADER) || (HEADER + ((raw[3] << 8) | raw[4]) + 2 <= FRAME_MAX));
+}
+
+int main ()
+{
+	static uint8_t raw[FRAME_MAX];		// Frame decoded so far
+	uint8_t start[HEADER * 2 + 2];		// Bytes received until the header checks, printed if it doesn't
+	int got = -1;		// -1 : text, otherwise bytes received since the 0x00
+	int n = 0;			// Decoded bytes
+	int left = 0;		// COBS : bytes left in the current group
+	int zero = 0;		// COBS : the current group ends with a zero
+	int c;
+
+	while ((c = getchar ()) != EOF)
+	{
+		if (c == 0)		// may start a frame
+		{
+			if (got > 0)
+				fprintf (stderr, "\n[bad frame]\n");		// cut short
+			got = n = left = zero = 0;
+			continue;
+		}
+		if (got < 0)
+		{
+			putchar (c);
+			if (c == '\n')
+				fflush (stdout);
+			continue;
+		}
+
+		if (n < HEADER)
+			start[got] = c;
+		got++;
+		if (left == 0)		// COBS code
+		{
+			if (zero)
+				raw[n++] = 0;
+			left = c - 1;
+			zero = (c != 0xFF);
+		}
+		else
+		{
+			raw[n++] = c;
+			left--;
+		}
+
+		if (!header_ok (raw, n))
+		{
+			fwrite (start, 1, got, stdout);		// text after a 0x00
+			fflush (stdout);
+			got = -1;
+		}
+		else if ((n >= HEADER) && (n == HEADER + ((raw[3] << 8) | raw[4]) + 2))
+		{
+			frame (raw, n);		// complete : the closing 0x00 (if not lost) starts an empty frame
+			fflush (stdout);
+			got = -1;
+		}
+	}
+
+	return 0;
+}
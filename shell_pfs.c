@@ -3,14 +3,19 @@
  *
  * Application-specific PFS (Pseudo File System) defining the commands the user can execute through the shell.
  *
- * This is a TEMPLATE with a few EXAMPLE commands you may delete.
+ * Started as a template with a few example commands, it has grown into the runtime the commands rely on.
  * Hardware-specific LED macro requires a GPIO (output) pin labelled "LED".
  *
  * This file contains :
  *
- * - Command functions (the implementation of shell commands)
+ * - The command-writing macros and API (state machines, output queue, argument parsing, contexts, jobs)
+ * - The links (UART, USB CDC, RTT), DMA reception, binary mode, streaming and compressed output
+ * - Scheduling : idle detection, low-power idle, RTOS task, watchdog, profiling and tracing
+ * - Command functions (the example commands, benchmarks and diagnostics)
  * - Command blocks (linked-list forming a hierarchical tree of commands)
  *
+ * The application's hooks into all this are declared in shell_pfs.h.
+ *
  *  Created on: May 13, 2022
  *  Author: Jean Roch - Nefastor.com
  *
@@ -28,32 +33,3523 @@
  *  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "shell.h"
+#include "shell.h"
+#include "shell_pfs.h"
+
+#include "main.h"	// For the HAL
+
+#ifdef SHELL_PFS_RTOS
+#include "cmsis_os2.h"	// For the shell task (CMSIS-RTOS2, e.g. FreeRTOS from CubeMX)
+
+#define SHELL_PFS_FLAG_RX 0x01		// Thread flags of the shell task, see "RTOS integration"
+#define SHELL_PFS_FLAG_TX 0x02
+#endif
+
+#ifdef SHELL_PFS_USB_CDC
+#include "usbd_cdc_if.h"	// For the USB CDC link (CubeMX USB device, CDC class)
+#endif
+#ifdef SHELL_PFS_RTT
+#include "SEGGER_RTT.h"		// For the RTT link
+#endif
+
+#include <stdarg.h>	// For shell_pfs_printf
+#include <string.h>	// For strlen
+#include <limits.h>	// For LONG_MAX in shell_pfs_int
+
+// Macros for programming command functions more easily :
+// Start a state machine:
+#define STATE_MACHINE static int state = 0; BG_SUFFIX STEP_BEGIN switch (state) {
+// Start a state machine keeping its state and locals (struct type "t", reached through "ctx") in the context pool:
+#define CONTEXT_MACHINE(t) _Static_assert (sizeof (t) <= SHELL_PFS_CTX_SIZE, "context too large : raise SHELL_PFS_CTX_SIZE"); BG_SUFFIX \
+	t_shell_pfs_ctx* const ctx_slot = shell_pfs_ctx_acquire (); if (ctx_slot == 0) return; \
+	t* const ctx = (t*) ctx_slot->data; int state = ctx_slot->state; STEP_BEGIN switch (state) {
+// Start a state machine state:
+#define STATE break; case
+// End a state machine:
+#define STATE_MACHINE_END } STEP_END
+#define CONTEXT_MACHINE_END } STEP_END shell_pfs_ctx_update (ctx_slot, state);
+// Return from state machine (can be used in any state) :
+#define RETURN state = 0; shell_pfs_end ();
+// End a command function:
+#define DONE shell_pfs_end ();
+// Print a formatted line (see shell_pfs_printf). If the output queue is full, yields and retries the same state :
+#define PRINT(...) if (!shell_pfs_printf (__VA_ARGS__)) break;
+// Append formatted text to the output (see shell_pfs_write). If the output queue is full, yields and retries the same state :
+#define WRITE(...) if (!shell_pfs_write (__VA_ARGS__)) break;
+// Split the command line into shell_pfs_argc / shell_pfs_argv (first state only, see shell_pfs_args) :
+#define ARGS if (shell_pfs_args () < 0) break;
+// True once the current step has used up its time budget (see shell_pfs_budget) :
+#define OVER_BUDGET ((SHELL_PFS_CYCLES () - step_t0) > shell_pfs_budget)
+// Yield for a number of milliseconds, the state machine resumes in the state it has set (see shell_pfs_sleep) :
+#define SLEEP(ms) shell_pfs_sleep (ms);
+// Report forward progress without a state change, for the watchdog (see shell_pfs_progress) :
+#define PROGRESS shell_pfs_progress ();
+
+// LED control macro. This is hardware specific, make sure "LED" refers to the correct pin on your target.
+// If your board doesn't have an LED, define SHELL_NO_LED to replace with a dummy macro
+#ifndef SHELL_NO_LED
+#define LED(a) HAL_GPIO_WritePin(LED_GPIO_Port, LED_Pin, ((a) == 1) ? GPIO_PIN_SET : GPIO_PIN_RESET)
+#else
+#define LED(a)
+#endif
+
+// Optional : name of the shell's UART handle (e.g. -DSHELL_PFS_UART=huart3), for the commands driving the UART directly
+#ifdef SHELL_PFS_UART
+extern UART_HandleTypeDef SHELL_PFS_UART;
+#endif
+
+// Command table entries, with the command name (and its arguments) apart from the help text. The label
+// is assembled at compile time as "name - help", the format the shell lists and matches. Define
+// SHELL_PFS_NO_HELP for production images : the help text is left out and the labels are only names.
+#ifndef SHELL_PFS_NO_HELP
+#define SHELL_PFS_HELP(help) " - " help
+#else
+#define SHELL_PFS_HELP(help)
+#endif
+#define SHELL_PFS_CMD(name, help, fp) {name SHELL_PFS_HELP(help), fp, 0}
+#define SHELL_PFS_MENU(name, help, blk) {name SHELL_PFS_HELP(help), 0, CMD_BLOCK blk}
+
+// Linked command blocks : entries registered from any module, gathered and counted by the linker.
+// SHELL_PFS_BLOCK defines a block's title in section .shell_pfs_BLK_0, SHELL_PFS_REGISTER(_MENU) adds
+// each entry to its own section .shell_pfs_BLK_1.NAME (NAME : the command function or the submenu's block).
+// The linker script lays them out one after the other and defines the count as a symbol, whose address
+// the title uses as its BLOCK_LEN. Nothing runs at startup and the count can't be wrong. Entries are
+// aligned to a pointer so they pack back to back, and the title being one entry, its size is
+// sizeof (t_shell_block_entry) on any target. SORT_BY_NAME lists the entries in the order of their NAME :
+// without it, files come in link order but GCC emits the entries of one file in reverse order.
+// Linker script fragment, one per block (shell_pfs.ld has the demo's) :
+//
+//	.shell_pfs_root_block :
+//	{
+//		KEEP (*(.shell_pfs_root_block_0))
+//		__shell_pfs_root_block_entries = .;
+//		KEEP (*(SORT_BY_NAME (.shell_pfs_root_block_1.*)))
+//		root_block_count = ABSOLUTE ((. - __shell_pfs_root_block_entries) / (__shell_pfs_root_block_entries - ADDR (.shell_pfs_root_block)));
+//	} > FLASH
+//
+// Then, in C : SHELL_PFS_BLOCK(root_block, "STM32") in one module,
+// SHELL_PFS_REGISTER(root_block, "led", "toggles the blue LED", command_led_toggle) in any module.
+#define SHELL_PFS_BLOCK(blk, title) \
+	_Static_assert (sizeof (t_shell_block_entry) % sizeof (void*) == 0, "block entries must pack back to back"); \
+	extern char blk##_count[]; \
+	SHELL_PFS_TABLE t_shell_block_entry blk[1] __attribute__ ((used, aligned (sizeof (void*)), section (".shell_pfs_" #blk "_0"))) = {{title, BLOCK_LEN blk##_count, 0}};
+#define SHELL_PFS_REGISTER(blk, name, help, fp) \
+	static SHELL_PFS_TABLE t_shell_block_entry blk##_##fp __attribute__ ((used, aligned (sizeof (void*)), section (".shell_pfs_" #blk "_1." #fp))) = SHELL_PFS_CMD(name, help, fp);
+#define SHELL_PFS_REGISTER_MENU(blk, name, help, sub) \
+	static SHELL_PFS_TABLE t_shell_block_entry blk##_##sub __attribute__ ((used, aligned (sizeof (void*)), section (".shell_pfs_" #blk "_1." #sub))) = SHELL_PFS_MENU(name, help, sub);
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Command lookup index : optional hashed index over a command block's names
+// The command name is the part of the label before the first space ("flash N - ..." is "flash").
+// Declare an index with SHELL_PFS_INDEX right after a block, then resolve typed commands with
+// shell_pfs_lookup : the labels are hashed and sorted once, after that a lookup is a binary search
+// on the hash of the typed word, without splitting label strings at every keystroke.
+// The block table itself is not modified, so existing PFS trees remain source-compatible.
+/////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	uint32_t hash;			// FNV-1a hash of the command name
+	uint8_t len;			// Length of the command name
+	uint8_t entry;			// Position of the entry in the block (title is 0)
+} t_shell_pfs_key;
+
+typedef struct
+{
+	t_shell_block_entry* block;		// Indexed command block
+	t_shell_pfs_key* keys;			// One key per command, sorted by hash
+	int len;						// Number of commands in the block
+	int ready;						// Keys have been hashed and sorted
+	uint8_t* names;					// Entries sorted by name, for completion (optional)
+} t_shell_pfs_index;
+
+// Declare the index of a block. Must follow the block's definition : the number of keys
+// is taken from the size of the table itself, so it can't disagree with the table.
+#define SHELL_PFS_INDEX(blk) \
+	static t_shell_pfs_key blk##_keys[sizeof (blk) / sizeof (blk[0]) - 1]; \
+	static uint8_t blk##_names[sizeof (blk) / sizeof (blk[0]) - 1]; \
+	t_shell_pfs_index blk##_index = {(t_shell_block_entry*) blk, blk##_keys, sizeof (blk) / sizeof (blk[0]) - 1, 0, blk##_names};
+
+// Declare the index of a linked block (see SHELL_PFS_BLOCK), for up to "max" commands : the number of
+// keys is read from the block's title when the index is first used (a negative len stands for "max").
+#define SHELL_PFS_INDEX_LINKED(blk, max) \
+	static t_shell_pfs_key blk##_keys[max]; \
+	static uint8_t blk##_names[max]; \
+	t_shell_pfs_index blk##_index = {(t_shell_block_entry*) blk, blk##_keys, -(max), 0, blk##_names};
+
+// Number of commands in a block, from its title entry
+int shell_pfs_block_len (t_shell_block_entry* block)
+{
+	return (int) (intptr_t) block[0].command_fp;
+}
+
+// Hash a command name, stopping at the first space or at the end of the string
+static uint32_t shell_pfs_hash (const char* name, int* len)
+{
+	uint32_t h = 2166136261u;	// FNV-1a offset basis
+	int k;
+
+	for (k = 0; (name[k] != 0) && (name[k] != ' '); k++)
+		h = (h ^ (uint8_t) name[k]) * 16777619u;	// FNV-1a prime
+
+	*len = k;
+	return h;
+}
+
+// Compare two command names (labels, up to their first space)
+static int shell_pfs_name_cmp (const char* a, const char* b)
+{
+	for (; (*a != 0) && (*a != ' ') && (*a == *b); a++, b++);
+
+	return (uint8_t) ((*a == ' ') ? 0 : *a) - (uint8_t) ((*b == ' ') ? 0 : *b);
+}
+
+// Hash every label of the block and sort the keys (insertion sort : blocks are small, and this runs once)
+static void shell_pfs_index_build (t_shell_pfs_index* index)
+{
+	t_shell_pfs_key key;
+	int len, k, j;
+
+	if (index->len < 0)		// linked block : count from the title, up to the size of the index
+		index->len = (shell_pfs_block_len (index->block) < -index->len) ? shell_pfs_block_len (index->block) : -index->len;
+
+	for (k = 0; k < index->len; k++)
+	{
+		key.hash = shell_pfs_hash (index->block[k + 1].label, &len);
+		key.len = len;
+		key.entry = k + 1;
+
+		for (j = k; (j > 0) && (index->keys[j - 1].hash > key.hash); j--)
+			index->keys[j] = index->keys[j - 1];
+		index->keys[j] = key;
+
+		if (index->names == 0)
+			continue;
+		for (j = k; (j > 0) && (shell_pfs_name_cmp (index->block[index->names[j - 1]].label, index->block[k + 1].label) > 0); j--)
+			index->names[j] = index->names[j - 1];
+		index->names[j] = k + 1;
+	}
+
+	index->ready = 1;
+}
+
+// Find the entry matching the first word of "cmd" (typically shell_state.input). Returns 0 if none.
+t_shell_block_entry* shell_pfs_lookup (t_shell_pfs_index* index, const char* cmd)
+{
+	uint32_t h;
+	int len, lo, hi, mid;
+	t_shell_pfs_key* key;
+
+	if (!index->ready)
+		shell_pfs_index_build (index);
+
+	h = shell_pfs_hash (cmd, &len);
+
+	// Binary search for the first key with this hash
+	lo = 0;
+	hi = index->len;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (index->keys[mid].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	// Confirm the match (and step over hash collisions, if any)
+	for (key = &index->keys[lo]; (key < &index->keys[index->len]) && (key->hash == h); key++)
+		if ((key->len == len) && (memcmp (index->block[key->entry].label, cmd, len) == 0))
+			return &index->block[key->entry];
+
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Job records : the foreground command and the background jobs (see "Background jobs" below)
+// Slot 0 is the foreground command run by the shell itself, slots 1 and up are background jobs.
+// shell_pfs_job points at the slot whose command is being executed.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_MAX_JOBS
+#define SHELL_PFS_MAX_JOBS 3			// Number of background jobs
+#endif
+#ifndef SHELL_PFS_JOB_LINE
+#define SHELL_PFS_JOB_LINE 32			// Command line kept by a background job for its ARGS
+#endif
+
+typedef struct
+{
+	void (*fp)();				// Command function of a background job, 0 if the slot is free
+	void (*sleep_fp)();			// Command function to resume after a timed wait
+	uint32_t wake_tick;			// HAL tick at which it resumes
+	char line[SHELL_PFS_JOB_LINE];	// Command line of a background job
+	void (*wdg_fp)();			// Command the watchdog last saw in this slot (see "Watchdog")
+	uint32_t wdg_tick;			// HAL tick of its last progress
+} t_shell_pfs_job;
+
+t_shell_pfs_job shell_pfs_jobs[SHELL_PFS_MAX_JOBS + 1];
+t_shell_pfs_job* shell_pfs_job = &shell_pfs_jobs[0];	// Job being executed
+
+static void (*shell_pfs_fg_checked)() = 0;	// Foreground command already checked for a trailing "&" (see shell_pfs_bg_suffix)
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Cycle counter : the Cortex-M DWT cycle counter, used by profiling and time measurements
+// Enabled by shell_pfs_init. Cores without a DWT (Cortex-M0/M0+) fall back on the HAL tick.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_CYCLES		// may come from the build (the host simulation has its own, see host/main.h)
+#ifdef DWT
+#define SHELL_PFS_CYCLES() (DWT->CYCCNT)
+#else
+#define SHELL_PFS_CYCLES() (HAL_GetTick () * (SystemCoreClock / 1000))
+#endif
+#endif
+
+static void shell_pfs_cycles_init ()
+{
+#ifdef DWT
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;		// enable the trace and debug blocks
+#if (__CORTEX_M == 7)
+	DWT->LAR = 0xC5ACCE55;		// the M7's DWT is locked after reset
+#endif
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Trace : a ring of timestamped events in RAM, for a post-mortem look at what the shell was doing
+// Define SHELL_PFS_TRACE to record commands getting the CPU, their state changes and ends (from the
+// state machine macros), output handed to the shell, sent, and waits. Records are fixed-size and
+// written as they are, about 20 cycles per event : "trace" prints them.
+// Define SHELL_PFS_TRACE_NOINIT as well to keep the ring across a reset, in a .noinit section the
+// linker script has to provide (not cleared by the startup code) :
+//   .noinit (NOLOAD) : { *(.noinit*) } >RAM
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_TRACE_LEN
+#define SHELL_PFS_TRACE_LEN 64				// Records in the ring (must be a power of two)
+#endif
+
+#define TRACE_MAGIC 0x54524345				// "TRCE" : the ring survived a reset
+
+// Events
+#define TRACE_RESET 0		// shell_pfs_init (arg : 1 if the ring survived a reset)
+#define TRACE_RUN 1			// a command (fp) gets the CPU after another one, or for its first step (arg : state)
+#define TRACE_STATE 2		// state change (arg : new state)
+#define TRACE_END 3			// the command ends (RETURN, DONE)
+#define TRACE_OUT 4			// output handed to the shell (arg : length)
+#define TRACE_SENT 5		// the shell's output is done
+#define TRACE_WAIT 6		// output queue full, the command retries
+#define TRACE_SLEEP 7		// SLEEP (arg : milliseconds)
+
+typedef struct
+{
+	uint32_t time;			// Cycle counter
+	void (*fp)();			// Running command (see the map file)
+	uint16_t event;
+	uint16_t arg;
+} t_shell_pfs_trace_rec;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t head;			// Records written so far
+	uint32_t off;			// Recording paused
+	t_shell_pfs_trace_rec rec[SHELL_PFS_TRACE_LEN];
+} t_shell_pfs_trace;
+
+#ifdef SHELL_PFS_TRACE
+
+#ifdef SHELL_PFS_TRACE_NOINIT
+__attribute__ ((section (".noinit"))) t_shell_pfs_trace shell_pfs_trace_buf;
+#else
+t_shell_pfs_trace shell_pfs_trace_buf;
+#endif
+
+static void (*shell_pfs_trace_fp)() = 0;	// Command of the last RUN event, 0 after an END
+static int shell_pfs_trace_out = 0;			// Output handed to the shell, not sent yet
+
+static inline void shell_pfs_trace (int event, int arg)
+{
+	t_shell_pfs_trace_rec* rec;
+
+	if (shell_pfs_trace_buf.off)
+		return;
+
+	rec = &shell_pfs_trace_buf.rec[shell_pfs_trace_buf.head++ & (SHELL_PFS_TRACE_LEN - 1)];
+	rec->time = SHELL_PFS_CYCLES ();
+	rec->fp = (shell_pfs_trace_fp != 0) ? shell_pfs_trace_fp : shell_state.command_fp;		// not SLEEP's wait function
+	rec->event = event;
+	rec->arg = arg;
+}
+
+static void shell_pfs_trace_init ()
+{
+	int kept = (shell_pfs_trace_buf.magic == TRACE_MAGIC);
+
+	if (!kept)
+	{
+		shell_pfs_trace_buf.magic = TRACE_MAGIC;
+		shell_pfs_trace_buf.head = 0;
+	}
+	shell_pfs_trace_buf.off = 0;
+	shell_pfs_trace (TRACE_RESET, kept);
+}
+
+// Used by the state machine macros : a command step starts, a command step ends
+#define TRACE_STEP_BEGIN \
+	if (shell_state.command_fp != shell_pfs_trace_fp) { shell_pfs_trace_fp = shell_state.command_fp; shell_pfs_trace (TRACE_RUN, state); }
+#define TRACE_STEP_END if ((state != step_s0) && (shell_pfs_trace_fp != 0)) shell_pfs_trace (TRACE_STATE, state);
+#define TRACE(event, arg) shell_pfs_trace (event, arg);
+
+#else
+#define TRACE_STEP_BEGIN
+#define TRACE_STEP_END
+#define TRACE(event, arg)
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Timed waits : a command can sleep until a HAL tick deadline instead of counting down a delay
+// shell_pfs_sleep swaps the command function for a wait function until the deadline has passed :
+// the shell keeps calling shell_state.command_fp, but each call is only a tick comparison,
+// leaving the CPU to the application loop. Timings no longer depend on clock speed or caches.
+/////////////////////////////////////////////////////////////////////////////////////
+
+// Stands in for the sleeping command
+static void shell_pfs_sleep_wait ()
+{
+	if ((int32_t) (HAL_GetTick () - shell_pfs_job->wake_tick) < 0)
+		return;		// Still sleeping (the signed difference handles tick wrap-around)
+
+	// Deadline reached : put the command back and run its next step right away
+	shell_state.command_fp = shell_pfs_job->sleep_fp;
+	shell_pfs_job->sleep_fp ();
+}
+
+// Suspend the calling command for "ms" milliseconds. It must set its next state before yielding.
+void shell_pfs_sleep (uint32_t ms)
+{
+	TRACE(TRACE_SLEEP, ms)
+	shell_pfs_job->sleep_fp = shell_state.command_fp;
+	shell_pfs_job->wake_tick = HAL_GetTick () + ms;
+	shell_state.command_fp = shell_pfs_sleep_wait;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Watchdog : kick the application's watchdog only while the shell is healthy
+// Healthy means the main loop calls shell_pfs_poll, and every running command (foreground and background)
+// has made progress in the last SHELL_PFS_WDG_MS : a state change, output handed to the shell, or a
+// PROGRESS call for commands that work or wait in one state. Sleeping commands have a deadline and are
+// healthy. shell_pfs_poll kicks through SHELL_PFS_WDG_KICK() if it's defined, e.g. as
+// HAL_IWDG_Refresh (&hiwdg), in place of an unconditional kick in the main loop. Steps may then be as
+// long as the watchdog period allows (see shell_pfs_budget) : a stuck command still gets the MCU reset.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_WDG_MS
+#define SHELL_PFS_WDG_MS 1000		// Longest time without progress, shorter than the watchdog period
+#endif
+
+static uint32_t shell_pfs_wdg_loop;		// HAL tick of the last shell_pfs_poll
+
+// The calling command moves forward (PROGRESS macro)
+void shell_pfs_progress ()
+{
+	shell_pfs_job->wdg_tick = HAL_GetTick ();
+}
+
+// Check the command in a job slot
+static int shell_pfs_job_healthy (t_shell_pfs_job* job, void (*fp)(), uint32_t now)
+{
+	if ((fp == 0) || (fp == shell_pfs_sleep_wait) || (fp != job->wdg_fp))
+	{
+		job->wdg_fp = fp;		// idle, sleeping, or a new command : as good as progress
+		job->wdg_tick = now;
+		return 1;
+	}
+
+	return (now - job->wdg_tick) < SHELL_PFS_WDG_MS;
+}
+
+// 1 if the main loop runs and no command is stuck : the application may kick its watchdog
+int shell_pfs_healthy ()
+{
+	uint32_t now = HAL_GetTick ();
+	int ok, k;
+
+	ok = ((now - shell_pfs_wdg_loop) < SHELL_PFS_WDG_MS);
+	ok &= shell_pfs_job_healthy (&shell_pfs_jobs[0], shell_state.command_fp, now);
+	for (k = 1; k <= SHELL_PFS_MAX_JOBS; k++)
+		ok &= shell_pfs_job_healthy (&shell_pfs_jobs[k], shell_pfs_jobs[k].fp, now);
+
+	return ok;
+}
+
+// From shell_pfs_poll
+static void shell_pfs_watchdog ()
+{
+	shell_pfs_wdg_loop = HAL_GetTick ();
+#ifdef SHELL_PFS_WDG_KICK
+	if (shell_pfs_healthy ())
+		SHELL_PFS_WDG_KICK();
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Step accounting : time budget and profiling of the steps of state machine commands
+// STATE_MACHINE / CONTEXT_MACHINE time every step. A step longer than shell_pfs_budget cycles counts as
+// an overrun : heavy loops should poll OVER_BUDGET and continue on the next call instead.
+// Define SHELL_PFS_PROFILING to also keep per-command records, listed by the "prof" command.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_STEP_BUDGET_US
+#define SHELL_PFS_STEP_BUDGET_US 50		// Default step budget, in microseconds
+#endif
+
+uint32_t shell_pfs_budget;			// Step budget, in cycles (set by shell_pfs_init)
+uint32_t shell_pfs_overruns = 0;	// Steps that took longer than the budget
+
+typedef struct s_shell_pfs_prof
+{
+	void (*fp)();					// Command function (0 until its first step)
+	uint32_t calls;					// Completed invocations
+	uint32_t steps;					// Steps executed (calls to the command function)
+	uint32_t overruns;				// Steps over budget
+	uint32_t max;					// Longest step, in cycles
+	uint64_t total;					// Cycles spent in all steps
+	struct s_shell_pfs_prof* next;	// Next record in the list
+} t_shell_pfs_prof;
+
+static t_shell_pfs_prof* shell_pfs_prof_list = 0;
+
+#ifdef SHELL_PFS_PROFILING
+#define PROF_BEGIN static t_shell_pfs_prof prof_rec; shell_pfs_prof_register (&prof_rec);
+#define PROF_REC (&prof_rec)
+#else
+#define PROF_BEGIN
+#define PROF_REC 0
+#endif
+
+// Used by the state machine macros :
+#define BG_SUFFIX if (shell_pfs_bg_suffix ()) return;
+#define STEP_BEGIN uint32_t step_t0 = SHELL_PFS_CYCLES (); int step_s0 = state; PROF_BEGIN TRACE_STEP_BEGIN
+#define STEP_END TRACE_STEP_END if (state != step_s0) shell_pfs_progress (); shell_pfs_step_end (step_t0, PROF_REC);
+
+// Add a command's record to the list, on its first step
+void shell_pfs_prof_register (t_shell_pfs_prof* rec)
+{
+	if (rec->fp != 0)
+		return;
+
+	rec->fp = shell_state.command_fp;
+	rec->next = shell_pfs_prof_list;
+	shell_pfs_prof_list = rec;
+}
+
+// Account for a step. An invocation is complete once the command gives up shell_state.command_fp.
+void shell_pfs_step_end (uint32_t t0, t_shell_pfs_prof* rec)
+{
+	uint32_t c = SHELL_PFS_CYCLES () - t0;
+	int over = (c > shell_pfs_budget);
+
+	shell_pfs_overruns += over;
+	if (rec == 0)
+		return;
+
+	rec->steps++;
+	rec->overruns += over;
+	rec->total += c;
+	if (c > rec->max)
+		rec->max = c;
+	if ((shell_state.command_fp != rec->fp) && (shell_state.command_fp != shell_pfs_sleep_wait))
+		rec->calls++;
+}
+
+// Find the record of a command function, 0 if it has never run (or isn't profiled)
+t_shell_pfs_prof* shell_pfs_prof_find (void (*fp)())
+{
+	t_shell_pfs_prof* rec;
+
+	for (rec = shell_pfs_prof_list; rec != 0; rec = rec->next)
+		if (rec->fp == fp)
+			return rec;
+
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Output queue : a ring of line slots in front of shell_state.output
+// A command formats its output into the next free slot and keeps working while the shell's DMA
+// sends the previous line. shell_pfs_out_pump hands the oldest queued line to shell_state_output
+// as soon as the UART is idle, so a streaming command only waits when the whole queue is full.
+// shell_state.output is the DMA source owned by the shell : the pump has to copy into it, which
+// costs a few cycles per byte against ~87 us per byte on the wire at 115200 bauds.
+// The pump joins as many queued slots as SHELL_PFS_OUT_MAX allows into each transfer, and
+// shell_pfs_write appends text to an open slot, so short fields don't cost a transfer each.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_OUT_SLOTS
+#define SHELL_PFS_OUT_SLOTS 4			// Number of queued lines (must be a power of two)
+#endif
+#ifndef SHELL_PFS_OUT_SLOT_LEN
+#define SHELL_PFS_OUT_SLOT_LEN 64		// Size of a line slot, must not exceed the shell's output buffer
+#endif
+#ifndef SHELL_PFS_OUT_MAX
+#define SHELL_PFS_OUT_MAX ((int) sizeof (shell_state.output))	// Most bytes in one transfer : the shell's output buffer
+#endif
+
+_Static_assert (SHELL_PFS_OUT_MAX <= (int) sizeof (shell_state.output), "SHELL_PFS_OUT_MAX exceeds the shell's output buffer");
+_Static_assert (SHELL_PFS_OUT_SLOT_LEN <= SHELL_PFS_OUT_MAX, "a line slot must fit in one transfer : lower SHELL_PFS_OUT_SLOT_LEN");
+
+static char shell_pfs_out_ring[SHELL_PFS_OUT_SLOTS][SHELL_PFS_OUT_SLOT_LEN];
+static unsigned int shell_pfs_out_head = 0;		// Slots committed so far
+static unsigned int shell_pfs_out_tail = 0;		// Slots sent so far
+static int shell_pfs_out_fill = 0;				// Text appended to the open slot (the next free one), see shell_pfs_write
+
+int shell_pfs_binary = 0;		// 1 while the shell is in binary mode (see "Binary mode") : no text output
+int shell_pfs_streaming = 0;	// 1 while a stream owns the UART (see "Streaming") : no text output
+int shell_pfs_zip = 0;			// 1 while text output is compressed (see "Compressed output")
+int shell_pfs_zip_pump ();
+int shell_pfs_zip_busy ();
+
+// Number of lines waiting to be sent
+int shell_pfs_out_pending ()
+{
+	return shell_pfs_out_head - shell_pfs_out_tail;
+}
+
+// No free slot for the running command. In binary mode, background jobs leave the last one to the
+// request's command, whose lines are taken back after each of its steps (see command_bin).
+static int shell_pfs_out_full ()
+{
+	if (shell_pfs_binary && (shell_pfs_job > &shell_pfs_jobs[0]) && (shell_pfs_job <= &shell_pfs_jobs[SHELL_PFS_MAX_JOBS]))
+		return shell_pfs_out_pending () >= SHELL_PFS_OUT_SLOTS - 1;
+
+	return shell_pfs_out_pending () == SHELL_PFS_OUT_SLOTS;
+}
+
+// Queue the open slot, if text was appended to it
+static void shell_pfs_out_close ()
+{
+	if (shell_pfs_out_fill == 0)
+		return;
+
+	shell_pfs_out_head++;
+	shell_pfs_out_fill = 0;
+}
+
+// Get the next free slot to format a line into, or 0 if the queue is full
+char* shell_pfs_out_alloc ()
+{
+	shell_pfs_out_close ();		// appended text goes out first
+
+	if (shell_pfs_out_full ())
+		return 0;
+
+	return shell_pfs_out_ring[shell_pfs_out_head % SHELL_PFS_OUT_SLOTS];
+}
+
+// Queue the slot returned by shell_pfs_out_alloc
+void shell_pfs_out_commit ()
+{
+	shell_pfs_out_head++;
+}
+
+// Send the oldest queued line if the shell's output is idle. Returns 1 if a transfer was started :
+// the command should then yield, the shell will call it again once the line is handed to the DMA.
+// Background jobs never pump, shell_pfs_jobs_poll does it for them.
+int shell_pfs_out_pump ()
+{
+	char* line;
+	int len, n;
+
+	if ((shell_pfs_job != &shell_pfs_jobs[0]) || shell_pfs_binary || shell_pfs_streaming)
+		return 0;
+	if (shell_pfs_zip)
+		return shell_pfs_zip_pump ();
+
+	if ((shell_state.busy != 0) || (shell_fp == shell_state_output) || (shell_pfs_out_pending () == 0))
+		return 0;	// transfer in progress, line already handed over, or nothing to send
+
+	// Join the queued slots into one transfer while they fit (the first one always does)
+	len = 0;
+	do
+	{
+		line = shell_pfs_out_ring[shell_pfs_out_tail % SHELL_PFS_OUT_SLOTS];
+		n = strlen (line);
+		if (len + n >= SHELL_PFS_OUT_MAX)
+			break;
+		memcpy (&shell_state.output[len], line, n + 1);
+		len += n;
+		shell_pfs_out_tail++;
+	} while (shell_pfs_out_pending () != 0);
+
+	TRACE(TRACE_OUT, len)
+	shell_pfs_progress ();
+#ifdef SHELL_PFS_TRACE
+	shell_pfs_trace_out = 1;
+#endif
+	shell_fp = shell_state_output;		// transition to output state
+	return 1;
+}
+
+// Oldest queued line, or 0 if none (for consumers other than the shell's output, such as binary mode)
+char* shell_pfs_out_peek ()
+{
+	if (shell_pfs_out_pending () == 0)
+		return 0;
+
+	return shell_pfs_out_ring[shell_pfs_out_tail % SHELL_PFS_OUT_SLOTS];
+}
+
+// Remove the line returned by shell_pfs_out_peek
+void shell_pfs_out_drop ()
+{
+	shell_pfs_out_tail++;
+}
+
+// Queue the text appended so far and start sending it : when a command yields, or before it waits
+void shell_pfs_flush ()
+{
+	shell_pfs_out_close ();
+	shell_pfs_out_pump ();
+}
+
+// A command ends once its queued output has been sent
+static void shell_pfs_out_drain ()
+{
+	if (shell_pfs_out_pump () || (shell_pfs_out_pending () != 0) || (shell_state.busy != 0) || shell_pfs_zip_busy ())
+		return;
+
+	shell_fp = shell_state_output;		// back to the prompt...
+	shell_state.command_fp = 0;			// ... this command has ended
+}
+
+// End the calling command (RETURN and DONE macros). Lines still queued are sent first, except in binary
+// mode : command_bin takes the request's lines back, the others wait for the text console.
+void shell_pfs_end ()
+{
+	TRACE(TRACE_END, 0)
+	if (shell_pfs_job == &shell_pfs_jobs[0])
+		shell_pfs_fg_checked = 0;		// the next foreground command gets checked again
+#ifdef SHELL_PFS_TRACE
+	shell_pfs_trace_fp = 0;
+#endif
+	shell_pfs_out_close ();
+	if (shell_pfs_binary || ((shell_pfs_out_pending () == 0) && !shell_pfs_zip_busy ()))
+	{
+		shell_fp = shell_state_output;
+		shell_state.command_fp = 0;
+	}
+	else
+		shell_state.command_fp = shell_pfs_out_drain;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Formatted output : a small printf replacement for command output
+// Supports %d %i %u %x %X %c %s %%, the 'l' length modifier, a field width with optional '0' padding,
+// and fixed-point decimals : "%.2d" prints the integer 1234 as "12.34".
+// Only integer arithmetic, no heap and a small stack frame, unlike newlib's reentrant printf.
+/////////////////////////////////////////////////////////////////////////////////////
+
+// Format into "buf" (at most size - 1 characters plus terminator). Returns the length of the result.
+int shell_pfs_vformat (char* buf, int size, const char* fmt, va_list ap)
+{
+	char digits[24];		// enough for a 64-bit value in decimal
+	const char* str;
+	unsigned long u;
+	long v;
+	int n = 0;
+	int width, prec, zero, lng, neg, base, len, k;
+
+	// Append a character, truncating at the end of the buffer
+	#define PUT(c) { if (n < size - 1) buf[n++] = (c); }
+
+	for (; *fmt != 0; fmt++)
+	{
+		if (*fmt != '%')
+		{
+			PUT(*fmt)
+			continue;
+		}
+
+		// Parse flags, width, precision and length
+		fmt++;
+		zero = (*fmt == '0');
+		width = 0;
+		prec = 0;
+		while ((*fmt >= '0') && (*fmt <= '9'))
+			width = width * 10 + (*fmt++ - '0');
+		if (*fmt == '.')
+			for (fmt++; (*fmt >= '0') && (*fmt <= '9'); fmt++)
+				prec = prec * 10 + (*fmt - '0');
+		lng = (*fmt == 'l');
+		if (lng)
+			fmt++;
+
+		neg = 0;
+		base = 10;
+		switch (*fmt)
+		{
+			case 'd':
+			case 'i':
+				v = lng ? va_arg (ap, long) : va_arg (ap, int);
+				neg = (v < 0);
+				u = neg ? -(unsigned long) v : (unsigned long) v;
+				break;
+			case 'x':
+			case 'X':
+				base = 16;
+				prec = 0;
+				// fall through
+			case 'u':
+				u = lng ? va_arg (ap, unsigned long) : va_arg (ap, unsigned int);
+				break;
+			case 'c':
+				PUT((char) va_arg (ap, int))
+				continue;
+			case 's':
+				str = va_arg (ap, const char*);
+				for (len = strlen (str); len < width; width--)
+					PUT(' ')
+				for (; *str != 0; str++)
+					PUT(*str)
+				continue;
+			case 0:		// format string ends with '%'
+				fmt--;
+				continue;
+			default:	// "%%" prints '%', unknown conversions print their letter
+				PUT(*fmt)
+				continue;
+		}
+
+		// Convert, least significant digit first. Fixed-point needs at least prec + 1 digits.
+		len = 0;
+		do
+		{
+			k = u % base;
+			digits[len++] = (k < 10) ? ('0' + k) : (((*fmt == 'X') ? 'A' : 'a') + k - 10);
+			u /= base;
+		} while ((u != 0) || (len <= prec));
+
+		// Pad to the field width : zeros go after the sign, spaces before it
+		width -= len + neg + (prec > 0);
+		if (neg && zero)
+			PUT('-')
+		for (; width > 0; width--)
+			PUT(zero ? '0' : ' ')
+		if (neg && !zero)
+			PUT('-')
+
+		while (len > 0)
+		{
+			if (len-- == prec)
+				PUT('.')
+			PUT(digits[len])
+		}
+	}
+
+	#undef PUT
+
+	if (size > 0)
+		buf[n] = 0;
+	return n;
+}
+
+// Format into "buf", like snprintf
+int shell_pfs_format (char* buf, int size, const char* fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start (ap, fmt);
+	n = shell_pfs_vformat (buf, size, fmt, ap);
+	va_end (ap);
+	return n;
+}
+
+// Format a line into the output queue and start sending it if possible.
+// Returns 0 if the queue is full : nothing was printed, try again on the next call.
+int shell_pfs_printf (const char* fmt, ...)
+{
+	va_list ap;
+	char* line = shell_pfs_out_alloc ();
+
+	if (line == 0)
+	{
+		TRACE(TRACE_WAIT, 0)
+		shell_pfs_out_pump ();
+		return 0;
+	}
+
+	va_start (ap, fmt);
+	shell_pfs_vformat (line, SHELL_PFS_OUT_SLOT_LEN, fmt, ap);
+	va_end (ap);
+
+	shell_pfs_out_commit ();
+	shell_pfs_out_pump ();
+	return 1;
+}
+
+// Append formatted text to the open slot, without a transfer of its own : one state can emit many
+// fields. The slot is queued once the next text doesn't fit, when a line is printed, and when the
+// command yields (shell_pfs_poll flushes it) or ends.
+// Returns 0 if the queue is full : nothing was written, try again on the next call.
+int shell_pfs_write (const char* fmt, ...)
+{
+	char text[SHELL_PFS_OUT_SLOT_LEN];
+	va_list ap;
+	int len;
+
+	va_start (ap, fmt);
+	len = shell_pfs_vformat (text, sizeof (text), fmt, ap);
+	va_end (ap);
+
+	if (shell_pfs_out_fill + len >= SHELL_PFS_OUT_SLOT_LEN)
+	{
+		shell_pfs_out_close ();		// slot full : queue it, continue in the next one
+		shell_pfs_out_pump ();
+	}
+	if (shell_pfs_out_full ())
+	{
+		TRACE(TRACE_WAIT, 0)
+		shell_pfs_out_pump ();
+		return 0;
+	}
+
+	memcpy (&shell_pfs_out_ring[shell_pfs_out_head % SHELL_PFS_OUT_SLOTS][shell_pfs_out_fill], text, len + 1);
+	shell_pfs_out_fill += len;
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Command line arguments : the input line split once into an argc / argv pair
+// shell_pfs_tokenize cuts the line in place (no copy) : separators are replaced by terminators and
+// shell_pfs_argv points at each word, shell_pfs_argv[0] being the command name itself.
+// Call it once, in the first state of the command (ARGS macro). Then convert with shell_pfs_arg_int.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_MAX_ARGS
+#define SHELL_PFS_MAX_ARGS 8		// Words beyond this are ignored
+#endif
+
+int shell_pfs_argc = 0;
+char* shell_pfs_argv[SHELL_PFS_MAX_ARGS];
+
+// Split a line into words separated by spaces or tabs. Returns the number of words.
+int shell_pfs_tokenize (char* line)
+{
+	shell_pfs_argc = 0;
+
+	while (shell_pfs_argc < SHELL_PFS_MAX_ARGS)
+	{
+		while ((*line == ' ') || (*line == '\t'))
+			line++;
+		if ((*line == 0) || (*line == '\r') || (*line == '\n'))
+			break;
+
+		shell_pfs_argv[shell_pfs_argc++] = line;
+		while ((*line != 0) && (*line != ' ') && (*line != '\t') && (*line != '\r') && (*line != '\n'))
+			line++;
+		if (*line == 0)
+			break;
+		*line++ = 0;
+	}
+
+	return shell_pfs_argc;
+}
+
+// Convert a word to an integer : decimal, or hexadecimal with a "0x" prefix, optionally negative.
+// Returns 1 if the whole word is a number that fits, 0 otherwise ("value" is then left unchanged).
+// Hexadecimal may use all the bits of an unsigned long (addresses), decimal must fit a long.
+int shell_pfs_int (const char* str, long* value)
+{
+	unsigned long u = 0;
+	unsigned long max;
+	int neg = (*str == '-');
+	int base = 10;
+	int d;
+
+	if (neg)
+		str++;
+	if ((str[0] == '0') && ((str[1] == 'x') || (str[1] == 'X')))
+	{
+		base = 16;
+		str += 2;
+	}
+	max = (base == 16) ? ULONG_MAX : (unsigned long) LONG_MAX + neg;
+	if (*str == 0)
+		return 0;
+
+	for (; *str != 0; str++)
+	{
+		if ((*str >= '0') && (*str <= '9'))
+			d = *str - '0';
+		else if ((base == 16) && ((*str | 0x20) >= 'a') && ((*str | 0x20) <= 'f'))
+			d = (*str | 0x20) - 'a' + 10;
+		else
+			return 0;
+		if (u > (max - d) / base)
+			return 0;		// overflow
+		u = u * base + d;
+	}
+
+	*value = neg ? -(long) u : (long) u;
+	return 1;
+}
+
+// Convert argument "n" (1 is the first word after the command name). Returns 0 if it's missing or not a number.
+int shell_pfs_arg_int (int n, long* value)
+{
+	return (n < shell_pfs_argc) && shell_pfs_int (shell_pfs_argv[n], value);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Command contexts : per-invocation state taken from a shared pool
+// CONTEXT_MACHINE(type) is a STATE_MACHINE whose state and locals (a struct of the given type, reached
+// through "ctx") live in a pool slot instead of function statics. The slot belongs to the command and
+// the job running it : it is taken on the first call, zeroed, and released when the command returns.
+// RAM then scales with the number of running commands, and a command can run several times at once.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_CTX_COUNT
+#define SHELL_PFS_CTX_COUNT 4			// Number of commands that can hold a context at the same time
+#endif
+#ifndef SHELL_PFS_CTX_SIZE
+#define SHELL_PFS_CTX_SIZE 16			// Size of a context, in bytes
+#endif
+
+typedef struct
+{
+	void (*owner)();			// Command using the slot, 0 if free
+	t_shell_pfs_job* job;		// Job running that command
+	int state;					// State of the command's state machine
+	long long data[(SHELL_PFS_CTX_SIZE + 7) / 8];	// The command's locals (aligned for any type)
+} t_shell_pfs_ctx;
+
+static t_shell_pfs_ctx shell_pfs_ctx_pool[SHELL_PFS_CTX_COUNT];
+
+// Get the context of the running command, or a fresh one on its first call.
+// If the pool is exhausted, prints an error, ends the command and returns 0.
+t_shell_pfs_ctx* shell_pfs_ctx_acquire ()
+{
+	t_shell_pfs_ctx* ctx;
+	t_shell_pfs_ctx* free_ctx = 0;
+
+	for (ctx = shell_pfs_ctx_pool; ctx < &shell_pfs_ctx_pool[SHELL_PFS_CTX_COUNT]; ctx++)
+	{
+		if ((ctx->owner == shell_state.command_fp) && (ctx->job == shell_pfs_job))
+			return ctx;
+		if ((ctx->owner == 0) && (free_ctx == 0))
+			free_ctx = ctx;
+	}
+
+	if (free_ctx == 0)
+	{
+		shell_pfs_printf ("\r\nOut of command contexts");
+		shell_pfs_end ();
+		return 0;
+	}
+
+	memset (free_ctx, 0, sizeof (t_shell_pfs_ctx));
+	free_ctx->owner = shell_state.command_fp;
+	free_ctx->job = shell_pfs_job;
+	return free_ctx;
+}
+
+// Save the state at the end of a step, or release the context if the command has ended
+void shell_pfs_ctx_update (t_shell_pfs_ctx* ctx, int state)
+{
+	if ((shell_state.command_fp == ctx->owner) || (shell_state.command_fp == shell_pfs_sleep_wait))
+		ctx->state = state;
+	else
+		ctx->owner = 0;		// returned, or handed over to a background job
+}
+
+// Release the contexts held by a job (when it is killed)
+void shell_pfs_ctx_release (t_shell_pfs_job* job)
+{
+	int k;
+
+	for (k = 0; k < SHELL_PFS_CTX_COUNT; k++)
+		if (shell_pfs_ctx_pool[k].job == job)
+			shell_pfs_ctx_pool[k].owner = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Background jobs : several command state machines running concurrently
+// Jobs are stepped by shell_pfs_jobs_poll, through shell_pfs_poll which the application calls from its
+// main loop next to the shell's own polling : each call runs one step of one job, round-robin, then sends
+// queued output.
+// While a job runs, shell_state.command_fp holds the job's function, so the same command works in the
+// foreground and in the background. Its output shares the output queue with the foreground.
+// Jobs are started by the "bg" command ("bg load") or by ending a line with "&" ("flash 20 &").
+// Only commands built on CONTEXT_MACHINE should run more than once at a time : a command keeping its
+// state in function statics shares it between instances, and "kill" leaves it as it was.
+/////////////////////////////////////////////////////////////////////////////////////
+
+// Start "fp" as a background job with the command line "argv". Returns the job number, or 0 if it couldn't start.
+int shell_pfs_job_start (void (*fp)(), int argc, char** argv)
+{
+	t_shell_pfs_job* job = 0;
+	int k, n, len;
+
+	for (k = SHELL_PFS_MAX_JOBS; k > 0; k--)
+		if (shell_pfs_jobs[k].fp == 0)
+			job = &shell_pfs_jobs[k];
+	if (job == 0)
+		return 0;			// no free slot
+
+	// Keep a copy of the command line, the input buffer will be reused by the shell
+	for (k = 0, n = 0; (k < argc) && (n < SHELL_PFS_JOB_LINE - 1); k++)
+	{
+		if (k > 0)
+			job->line[n++] = ' ';
+		len = strlen (argv[k]);
+		if (len > SHELL_PFS_JOB_LINE - 1 - n)
+			len = SHELL_PFS_JOB_LINE - 1 - n;
+		memcpy (&job->line[n], argv[k], len);
+		n += len;
+	}
+	job->line[n] = 0;
+
+	job->fp = fp;
+	return job - shell_pfs_jobs;
+}
+
+// A foreground command whose line ends with "&" is restarted as a background job, before its first step
+// (state machine macros, so it works whether the command calls ARGS or not). Returns 1 if it was : the
+// foreground has returned to the prompt and the command must return.
+int shell_pfs_bg_suffix ()
+{
+	char* line = shell_state.input;
+	int n, len;
+
+	if ((shell_pfs_job != &shell_pfs_jobs[0]) || (shell_state.command_fp == shell_pfs_fg_checked))
+		return 0;
+	shell_pfs_fg_checked = shell_state.command_fp;		// once per command
+
+	for (len = strlen (line); (len > 0) && ((line[len - 1] == ' ') || (line[len - 1] == '\r') || (line[len - 1] == '\n')); len--);
+	if ((len < 2) || (line[len - 1] != '&') || (line[len - 2] != ' '))
+		return 0;
+
+	line[len - 1] = 0;
+	shell_pfs_tokenize (line);
+	n = shell_pfs_job_start (shell_state.command_fp, shell_pfs_argc, shell_pfs_argv);
+	if (n != 0)
+		shell_pfs_printf ("\r\n[%d] started", n);
+	else
+		shell_pfs_printf ("\r\nNo job slot available");
+	shell_pfs_end ();		// the foreground returns to the prompt
+	return 1;
+}
+
+// Split the command line of the running command (ARGS macro). A background job's line is copied first :
+// it stays whole for "jobs" and error messages. Returns -1 if the command was restarted as a background
+// job (see shell_pfs_bg_suffix, for commands that don't use the state machine macros) : it must yield.
+int shell_pfs_args ()
+{
+	static char line[SHELL_PFS_JOB_LINE];
+
+	if (shell_pfs_bg_suffix ())
+		return -1;
+	if (shell_pfs_job == &shell_pfs_jobs[0])
+		return shell_pfs_tokenize (shell_state.input);
+
+	strcpy (line, shell_pfs_job->line);
+	return shell_pfs_tokenize (line);
+}
+
+// Run one step of a job's command in place of the running one. Returns 0 once the job's command has ended.
+int shell_pfs_job_step (t_shell_pfs_job* job)
+{
+	void (*prev_command_fp)() = shell_state.command_fp;
+	void (*prev_shell_fp)() = shell_fp;
+	t_shell_pfs_job* prev_job = shell_pfs_job;
+	uint32_t prev_tick = job->wdg_tick;
+	int k;
+
+	// Switch to the job, run one step of its state machine, and switch back
+	shell_pfs_job = job;
+	shell_state.command_fp = job->fp;
+
+	job->fp ();
+	shell_pfs_out_close ();		// the job's appended text stays in one piece
+
+	job->fp = shell_state.command_fp;	// 0 once the job has returned
+	shell_state.command_fp = prev_command_fp;
+	shell_fp = prev_shell_fp;
+	shell_pfs_job = prev_job;
+
+	// The progress of a private job (sequence, binary request) is its caller's
+	for (k = 0; (k <= SHELL_PFS_MAX_JOBS) && (job != &shell_pfs_jobs[k]); k++);
+	if ((k > SHELL_PFS_MAX_JOBS) && (job->wdg_tick != prev_tick))
+		prev_job->wdg_tick = job->wdg_tick;
+
+	return job->fp != 0;
+}
+
+// Run one step of the next background job (part of shell_pfs_poll)
+void shell_pfs_jobs_poll ()
+{
+	static int next = 0;
+	int k;
+
+	for (k = 0; k < SHELL_PFS_MAX_JOBS; k++)
+	{
+		next = (next % SHELL_PFS_MAX_JOBS) + 1;
+		if (shell_pfs_jobs[next].fp == 0)
+			continue;
+
+		if (!shell_pfs_job_step (&shell_pfs_jobs[next]))
+			shell_pfs_printf ("\r\n[%d] done", next);
+		break;
+	}
+
+	// Send background output while the foreground isn't printing
+	shell_pfs_out_pump ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Transports : the links the PFS's bulk output can use, next to the shell's own UART
+// Binary mode, streams and dumps send on "the link" : the one chosen with the "link" command, or the
+// fastest one that's up (table order). RTT is never picked by itself : it always looks up, but without a
+// debugger draining it, its buffer fills and stays full, so use "link rtt" to choose it. Each link keeps its own transfer state, so one can be busy while
+// another sends. Built in, depending on the configuration : "usb" (SHELL_PFS_USB_CDC, the CubeMX CDC
+// class on hUsbDeviceFS), "rtt" (SHELL_PFS_RTT, SEGGER RTT buffer 0) and "uart" (SHELL_PFS_UART).
+// Input from USB goes through shell_pfs_link_rx (from CDC_Receive_FS), RTT input is polled : both join
+// the UART's interrupt-driven input (SHELL_PFS_RX), in binary mode only. The shell's prompt, echo and text
+// lines stay on its UART, so keys typed on another link are dropped rather than run out of sight.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#if defined (SHELL_PFS_UART) || defined (SHELL_PFS_USB_CDC) || defined (SHELL_PFS_RTT)
+#define SHELL_PFS_LINKS
+#endif
+
+typedef struct
+{
+	const char* name;
+	int (*up) ();									// The link can be used (e.g. USB enumerated)
+	int (*busy) ();									// A transfer is in progress
+	int (*send) (const uint8_t* data, int len);		// Start a transfer. Returns 0 if the link is busy.
+	int chained;									// Streams are chained by its completion interrupt
+	int automatic;									// Picked when up, without "link NAME"
+} t_shell_pfs_transport;
+
+#ifdef SHELL_PFS_USB_CDC
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+static int usb_up ()
+{
+	return hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED;
+}
+
+static int usb_busy ()
+{
+	USBD_CDC_HandleTypeDef* cdc = (USBD_CDC_HandleTypeDef*) hUsbDeviceFS.pClassData;
+
+	return (cdc == 0) || (cdc->TxState != 0);
+}
+
+static int usb_send (const uint8_t* data, int len)
+{
+	return CDC_Transmit_FS ((uint8_t*) data, len) == USBD_OK;
+}
+
+static const t_shell_pfs_transport usb_link = {"usb", usb_up, usb_busy, usb_send, 0, 1};
+#endif
+
+#ifdef SHELL_PFS_RTT
+static int rtt_up ()
+{
+	return 1;
+}
+
+static int rtt_busy ()
+{
+	return 0;		// RTT writes are memory copies : a transfer completes as soon as it starts
+}
+
+static int rtt_send (const uint8_t* data, int len)
+{
+	if (SEGGER_RTT_GetAvailWriteSpace (0) < (unsigned) len)
+		return 0;		// the debugger hasn't emptied the buffer yet
+
+	SEGGER_RTT_Write (0, data, len);
+	return 1;
+}
+
+static const t_shell_pfs_transport rtt_link = {"rtt", rtt_up, rtt_busy, rtt_send, 0, 0};	// "link rtt" only
+#endif
+
+#ifdef SHELL_PFS_UART
+static int uart_up ()
+{
+	return 1;
+}
+
+static int uart_busy ()
+{
+	return SHELL_PFS_UART.gState != HAL_UART_STATE_READY;
+}
+
+static int uart_send (const uint8_t* data, int len)
+{
+	return HAL_UART_Transmit_DMA (&SHELL_PFS_UART, (uint8_t*) data, len) == HAL_OK;
+}
+
+static const t_shell_pfs_transport uart_link = {"uart", uart_up, uart_busy, uart_send, 1, 1};
+#endif
+
+// Every link, fastest first
+static const t_shell_pfs_transport* const shell_pfs_links[] =
+{
+#ifdef SHELL_PFS_USB_CDC
+		&usb_link,
+#endif
+#ifdef SHELL_PFS_RTT
+		&rtt_link,
+#endif
+#ifdef SHELL_PFS_UART
+		&uart_link,
+#endif
+		0
+};
+
+const t_shell_pfs_transport* shell_pfs_link_forced = 0;		// Set by "link NAME", 0 to pick automatically
+const t_shell_pfs_transport* shell_pfs_link_in = 0;			// Link the latest input came from
+
+// Link for bulk output : the forced one if it's up, the fastest automatic one up otherwise. 0 if none.
+const t_shell_pfs_transport* shell_pfs_link ()
+{
+	int k;
+
+	if ((shell_pfs_link_forced != 0) && shell_pfs_link_forced->up ())
+		return shell_pfs_link_forced;
+
+	for (k = 0; shell_pfs_links[k] != 0; k++)
+		if (shell_pfs_links[k]->automatic && shell_pfs_links[k]->up ())
+			return shell_pfs_links[k];
+
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Binary mode : COBS-framed, CRC-checked requests and responses for automated test rigs
+// The "bin" command switches the shell to binary mode until it receives an empty request.
+// Request : path, arguments, CRC. The path is a list of entry positions in root_block and its submenus
+//           (position 0 is the title), ending at a command : {8} is "flash", {24, 1} is "sm1" / "load".
+//           The arguments are the rest of the command line, as text ("5" for "flash 5").
+// Response : status, payload, CRC. The payload holds the command's text output, or the raw data it
+//            passed to shell_pfs_bin_reply. CRC-16/CCITT (0xFFFF initial value), most significant byte first.
+// Received bytes are handed to shell_pfs_bin_rx (by the interrupt-driven input, if SHELL_PFS_RX is defined).
+// Responses are sent directly on the link the requests come from (see "Transports").
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_BIN_FRAME
+#define SHELL_PFS_BIN_FRAME 128		// Largest request or response, before framing
+#endif
+
+// Response status
+#define BIN_OK			0
+#define BIN_UNKNOWN		1		// The path doesn't lead to a command
+#define BIN_BAD_CRC		2		// The request is corrupted
+#define BIN_OVERFLOW	3		// The response has been truncated
+
+static uint8_t bin_rx[SHELL_PFS_BIN_FRAME + SHELL_PFS_BIN_FRAME / 254 + 1];	// Encoded request being received
+static volatile int bin_rx_len = 0;
+static volatile int bin_rx_ready = 0;		// A complete request is in bin_rx
+static uint8_t bin_req[SHELL_PFS_BIN_FRAME];	// Decoded request
+static uint8_t bin_resp[SHELL_PFS_BIN_FRAME];	// Response being built
+static int bin_resp_len;
+static uint8_t bin_tx[sizeof (bin_rx) + 2];	// Encoded response, with its delimiter
+
+// CRC-16/CCITT, 4 bits at a time
+uint16_t shell_pfs_crc16 (const uint8_t* data, int len, uint16_t crc)
+{
+	static const uint16_t table[16] =
+	{
+		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+		0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+	};
+
+	while (len-- > 0)
+	{
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (*data >> 4)];
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (*data++ & 0x0F)];
+	}
+
+	return crc;
+}
+
+// COBS-encode "len" bytes : the result has no zero byte. Returns its length (at most len + len / 254 + 1).
+int shell_pfs_cobs_encode (const uint8_t* in, int len, uint8_t* out)
+{
+	int code_pos = 0;	// where the current block's code byte goes
+	int n = 1;
+	uint8_t code = 1;
+
+	while (len-- > 0)
+	{
+		if (*in != 0)
+			out[n++] = *in;
+		in++;
+		if ((in[-1] == 0) || (++code == 0xFF))
+		{
+			out[code_pos] = code;
+			code_pos = n++;
+			code = 1;
+		}
+	}
+	out[code_pos] = code;
+	return n;
+}
+
+// Decode a COBS frame (without its delimiter). Returns the decoded length, or -1 if malformed or too long.
+int shell_pfs_cobs_decode (const uint8_t* in, int len, uint8_t* out, int size)
+{
+	int n = 0;
+	int code, k;
+
+	while (len > 0)
+	{
+		code = *in++;
+		len--;
+		if ((code == 0) || (code - 1 > len) || (n + code - 1 > size))
+			return -1;
+		for (k = 1; k < code; k++)
+			out[n++] = *in++;
+		len -= code - 1;
+		if ((code != 0xFF) && (len > 0))
+		{
+			if (n == size)
+				return -1;
+			out[n++] = 0;
+		}
+	}
+
+	return n;
+}
+
+// Feed a received byte (can be called from an interrupt). A zero byte ends a frame.
+void shell_pfs_bin_rx (uint8_t c)
+{
+	if (!shell_pfs_binary || bin_rx_ready)
+		return;		// not in binary mode, or the previous request is still pending : dropped
+
+	if (c == 0)
+		bin_rx_ready = (bin_rx_len > 0);
+	else if (bin_rx_len < (int) sizeof (bin_rx))
+		bin_rx[bin_rx_len++] = c;
+	else
+		bin_rx_len = sizeof (bin_rx) + 1;	// too long : decoding will reject it
+}
+
+// Append raw data to the response. Returns 0 when not in binary mode : the command should print text instead.
+// Returns -1 if the data didn't fit : the response is full and truncated (BIN_OVERFLOW).
+int shell_pfs_bin_reply (const void* data, int len)
+{
+	if (!shell_pfs_binary)
+		return 0;
+
+	if (bin_resp_len + len > SHELL_PFS_BIN_FRAME - 2)
+	{
+		len = SHELL_PFS_BIN_FRAME - 2 - bin_resp_len;
+		bin_resp[0] = BIN_OVERFLOW;
+	}
+	memcpy (&bin_resp[bin_resp_len], data, len);
+	bin_resp_len += len;
+	return (bin_resp[0] == BIN_OVERFLOW) ? -1 : 1;
+}
+
+// Frame and send the response. Returns 0 if the UART is still busy with the previous one.
+static int shell_pfs_bin_send ()
+{
+#ifdef SHELL_PFS_LINKS
+	const t_shell_pfs_transport* link = (shell_pfs_link_in != 0) ? shell_pfs_link_in : shell_pfs_link ();
+	uint16_t crc;
+	int n;
+
+	if (link == 0)
+		return 1;		// nowhere to send
+	if (link->busy ())
+		return 0;
+
+	crc = shell_pfs_crc16 (bin_resp, bin_resp_len, 0xFFFF);
+	bin_resp[bin_resp_len++] = crc >> 8;
+	bin_resp[bin_resp_len++] = crc & 0xFF;
+	n = shell_pfs_cobs_encode (bin_resp, bin_resp_len, bin_tx);
+	bin_tx[n++] = 0;
+	if (!link->send (bin_tx, n))
+	{
+		bin_resp_len -= 2;		// try again on the next call
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Streaming : continuous output from a producer callback, double-buffered on the link (see "Transports")
+// A streaming command calls shell_pfs_stream_start with its producer, then shell_pfs_stream_poll in each
+// of its steps. The poll calls the producer to refill whichever buffer the link has released. On the UART,
+// the transfer-complete interrupt chains the next buffer right away, so the UART never waits for the
+// shell's polling; other links are chained by the poll. The stream ends when the producer returns 0 or
+// on shell_pfs_stream_stop. The UART's completion interrupt must reach shell_pfs_stream_tx_cplt : with
+// USE_HAL_UART_REGISTER_CALLBACKS the stream registers it for its duration and puts the previous
+// callback back after, otherwise call it from HAL_UART_TxCpltCallback.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_STREAM_BUF
+#define SHELL_PFS_STREAM_BUF 256		// Size of each of the two stream buffers
+#endif
+
+// Producer : fill at most "size" bytes of "buf", return the number of bytes written (0 ends the stream)
+typedef int (*t_shell_pfs_producer) (uint8_t* buf, int size);
+
+#ifdef SHELL_PFS_LINKS
+static const t_shell_pfs_transport* stream_link;	// Link the stream is sent on
+static uint8_t stream_buf[2][SHELL_PFS_STREAM_BUF];
+static volatile int stream_len[2];			// Bytes to send in each buffer, 0 once sent
+static volatile int stream_tx;				// Buffer being sent (or next to send)
+static volatile int stream_idle;			// The DMA has nothing to send
+static int stream_fill;						// Next buffer to fill
+static volatile int stream_stop;			// Stop calling the producer
+#if defined (SHELL_PFS_UART) && (USE_HAL_UART_REGISTER_CALLBACKS == 1)
+static void (*stream_prev_cb) (UART_HandleTypeDef* huart);	// The UART's completion callback before the stream
+#endif
+static t_shell_pfs_producer stream_producer;
+
+// Transfer complete : chain the next buffer
+static void shell_pfs_stream_tx_done ()
+{
+	stream_len[stream_tx] = 0;
+	stream_tx ^= 1;
+	if ((stream_len[stream_tx] == 0) || !stream_link->send (stream_buf[stream_tx], stream_len[stream_tx]))
+		stream_idle = 1;		// underrun : shell_pfs_stream_poll restarts the transfers
+}
+#endif
+
+#ifdef SHELL_PFS_UART
+// UART transfer complete (interrupt). Returns 0 if the interrupt wasn't the stream's.
+int shell_pfs_stream_tx_cplt (UART_HandleTypeDef* huart)
+{
+	if ((huart != &SHELL_PFS_UART) || !shell_pfs_streaming || (stream_link != &uart_link))
+		return 0;
+
+	shell_pfs_stream_tx_done ();
+	return 1;
+}
+
+#if (USE_HAL_UART_REGISTER_CALLBACKS == 1)
+static void shell_pfs_stream_cb (UART_HandleTypeDef* huart)
+{
+	shell_pfs_stream_tx_cplt (huart);
+}
+#endif
+#endif
+
+// Take over the link for a stream. Returns 0 if it's not available.
+int shell_pfs_stream_start (t_shell_pfs_producer producer)
+{
+#ifdef SHELL_PFS_LINKS
+	if (shell_pfs_streaming || ((stream_link = shell_pfs_link ()) == 0) || stream_link->busy ())
+		return 0;
+#ifdef SHELL_PFS_UART
+	if ((stream_link == &uart_link) && (shell_state.busy != 0))
+		return 0;		// the shell is still using its UART
+#endif
+
+	stream_producer = producer;
+	stream_len[0] = stream_len[1] = 0;
+	stream_tx = stream_fill = 0;
+	stream_idle = 1;
+	stream_stop = 0;
+#if defined (SHELL_PFS_UART) && (USE_HAL_UART_REGISTER_CALLBACKS == 1)
+	if (stream_link == &uart_link)
+	{
+		stream_prev_cb = SHELL_PFS_UART.TxCpltCallback;
+		HAL_UART_RegisterCallback (&SHELL_PFS_UART, HAL_UART_TX_COMPLETE_CB_ID, shell_pfs_stream_cb);
+	}
+#endif
+	shell_pfs_streaming = 1;
+	return 1;
+#else
+	(void) producer;
+	return 0;
+#endif
+}
+
+// End the stream after the data already produced
+void shell_pfs_stream_stop ()
+{
+#ifdef SHELL_PFS_LINKS
+	stream_stop = 1;
+#endif
+}
+
+// Refill the stream and restart it after an underrun. Returns 0 once the stream has ended and the link is released.
+int shell_pfs_stream_poll ()
+{
+#ifdef SHELL_PFS_LINKS
+	int n;
+
+	if (!shell_pfs_streaming)
+		return 0;
+
+	// Links without a completion interrupt : chain the next buffer from here
+	if (!stream_link->chained && !stream_idle && !stream_link->busy ())
+		shell_pfs_stream_tx_done ();
+
+	// Refill the free buffers
+	while (!stream_stop && (stream_len[stream_fill] == 0))
+	{
+		n = stream_producer (stream_buf[stream_fill], SHELL_PFS_STREAM_BUF);
+		if (n <= 0)
+		{
+			stream_stop = 1;
+			break;
+		}
+		stream_len[stream_fill] = n;
+		stream_fill ^= 1;
+		shell_pfs_progress ();		// a buffer went out
+	}
+
+	// Restart the transfers if they ran dry. The interrupt only sets stream_idle while a transfer runs, so no race.
+	if (stream_idle)
+	{
+		if (stream_len[stream_tx] != 0)
+		{
+			stream_idle = 0;
+			if (!stream_link->send (stream_buf[stream_tx], stream_len[stream_tx]))
+				stream_idle = 1;		// link busy : retry on the next poll
+		}
+		else if (stream_stop)
+		{
+			// All sent : give the link back
+#if defined (SHELL_PFS_UART) && (USE_HAL_UART_REGISTER_CALLBACKS == 1)
+			if (stream_link == &uart_link)
+				HAL_UART_RegisterCallback (&SHELL_PFS_UART, HAL_UART_TX_COMPLETE_CB_ID, stream_prev_cb);	// the shell's own, or the weak default
+#endif
+			shell_pfs_streaming = 0;
+			return 0;
+		}
+	}
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Compressed output : text lines sent as LZ-compressed frames, for slow links (radio modems...)
+// While shell_pfs_zip is set ("zip on"), queued lines gather into a block, sent when full or after SHELL_PFS_ZIP_MS.
+// Frame : 0x00, COBS (0x5A 0xA5, frame number, LZ length, LZ data, CRC-16), 0x00. Decoder : host/shell_pfs_unzip.c
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_ZIP_BLOCK
+#define SHELL_PFS_ZIP_BLOCK 512		// Text compressed into each frame
+#endif
+#ifndef SHELL_PFS_ZIP_MS
+#define SHELL_PFS_ZIP_MS 20			// Time lines gather before a partial block is sent
+#endif
+#ifndef SHELL_PFS_ZIP_SYNC
+#define SHELL_PFS_ZIP_SYNC 16		// Frames between frames without history (a decoder that lost one picks up there)
+#endif
+
+#define ZIP_WINDOW 256				// History : text kept from the previous frames (the longest match distance)
+#define ZIP_HASH 256				// Hash table size (positions of 3-byte sequences)
+#define ZIP_HEADER 5				// Magic (2 bytes), frame number (bit 7 : uses history), LZ length (2 bytes)
+#define ZIP_MAX (ZIP_HEADER + SHELL_PFS_ZIP_BLOCK * 10 / 8 + 1 + 2)	// Header + worst-case LZ data + CRC
+
+#ifdef SHELL_PFS_LINKS
+static uint8_t zip_in[ZIP_WINDOW + SHELL_PFS_ZIP_BLOCK];	// History, then the lines gathered for the next frame
+static int zip_hist = 0;						// Bytes of history in front of the block
+static int zip_len = 0;
+static uint16_t zip_head[ZIP_HASH];				// Latest position in zip_in of each hashed sequence
+static int zip_frame = 0;						// Frames sent since "zip on"
+static uint32_t zip_start;						// Tick of the block's first line
+static uint8_t zip_out[ZIP_MAX];				// Compressed block
+static uint8_t zip_tx[ZIP_MAX + ZIP_MAX / 254 + 3];	// Frame being sent
+static const t_shell_pfs_transport* zip_link = 0;	// Link the last frame went to
+#endif
+
+#define ZIP_HASH3(p) ((((p)[0] * 33 + (p)[1]) * 33 + (p)[2]) & (ZIP_HASH - 1))
+
+// LZ data, MSB first : 0 + 4 bits, a character of zip_class ; 10 + 8 bits, any other character ;
+// 11 + distance - 1 (8 bits) + length : 2 bits (3 to 5), 11 + 4 bits (6 to 20) or 1111 + 8 bits (21 to 276).
+// Padded with 1s, too few to make an item.
+static const char zip_class[16] = "0123456789 \r\n:.-";
+
+// Write the "bits" low bits of "value" at bit "pos" of "out". Returns the next bit position.
+static int shell_pfs_zip_put (uint8_t* out, int pos, int value, int bits)
+{
+	for (bits--; bits >= 0; bits--, pos++)
+	{
+		if ((pos & 7) == 0)
+			out[pos >> 3] = 0;
+		if ((value >> bits) & 1)
+			out[pos >> 3] |= 0x80 >> (pos & 7);
+	}
+
+	return pos;
+}
+
+// Compress the "len" bytes at in + hist, the "hist" bytes before them being the history. "head" holds the
+// positions of the history's sequences (0xFFFF for none), it is cleared without history and updated.
+// Returns the compressed length (at most len * 10 / 8 + 1).
+int shell_pfs_zip_compress (const uint8_t* in, int hist, int len, uint8_t* out, uint16_t* head)
+{
+	const char* c;
+	int i = hist, pos = 0;
+	int cand = 0, mlen, k;
+
+	if (hist == 0)
+		for (k = 0; k < ZIP_HASH; k++)
+			head[k] = 0xFFFF;
+	for (k = (hist > 2) ? hist - 2 : 0; k < hist; k++)
+		if (k + 3 <= hist + len)
+			head[ZIP_HASH3(&in[k])] = k;		// the history's last sequences run into the block
+	len += hist;
+
+	while (i < len)
+	{
+		// Longest match with the latest sequence of the same hash (greedy)
+		mlen = 0;
+		if (i + 3 <= len)
+		{
+			k = ZIP_HASH3(&in[i]);
+			cand = head[k];
+			head[k] = i;
+			if ((cand != 0xFFFF) && (cand < i) && (i - cand <= 256))		// (later positions : from a frame the link refused)
+				for (; (i + mlen < len) && (mlen < 276) && (in[cand + mlen] == in[i + mlen]); mlen++);
+		}
+
+		if (mlen >= 3)
+		{
+			pos = shell_pfs_zip_put (out, pos, 0x300 | (i - cand - 1), 10);
+			if (mlen < 6)
+				pos = shell_pfs_zip_put (out, pos, mlen - 3, 2);
+			else if (mlen < 21)
+				pos = shell_pfs_zip_put (out, pos, 0x30 | (mlen - 6), 6);
+			else
+				pos = shell_pfs_zip_put (out, pos, 0xF00 | (mlen - 21), 12);
+			for (k = i + 1; (k < i + mlen) && (k + 3 <= len); k++)
+				head[ZIP_HASH3(&in[k])] = k;
+			i += mlen;
+		}
+		else if ((c = memchr (zip_class, in[i], sizeof (zip_class))) != 0)
+		{
+			pos = shell_pfs_zip_put (out, pos, c - zip_class, 5);
+			i++;
+		}
+		else
+			pos = shell_pfs_zip_put (out, pos, 0x200 | in[i++], 10);
+	}
+	while (pos & 7)
+		pos = shell_pfs_zip_put (out, pos, 1, 1);
+
+	return pos >> 3;
+}
+
+#ifdef SHELL_PFS_LINKS
+// Keep the end of the text sent as the next frame's history, and the hash table with it
+static void shell_pfs_zip_slide ()
+{
+	int drop = zip_hist + zip_len - ZIP_WINDOW;
+	int k;
+
+	if (drop < 0)
+		drop = 0;
+	memmove (zip_in, &zip_in[drop], zip_hist + zip_len - drop);
+	zip_hist += zip_len - drop;
+	zip_len = 0;
+	for (k = 0; k < ZIP_HASH; k++)
+		zip_head[k] = ((zip_head[k] != 0xFFFF) && (zip_head[k] >= drop)) ? zip_head[k] - drop : 0xFFFF;
+}
+#endif
+
+// Start compressing : the first frame has no history
+void shell_pfs_zip_reset ()
+{
+#ifdef SHELL_PFS_LINKS
+	zip_frame = 0;
+#endif
+}
+
+// Output pump in compressed mode (called by shell_pfs_out_pump). Returns 1 if a frame was sent.
+int shell_pfs_zip_pump ()
+{
+#ifdef SHELL_PFS_LINKS
+	const t_shell_pfs_transport* link = shell_pfs_link ();
+	uint16_t crc;
+	char* line;
+	int len, n;
+
+	// Gather the queued lines into the block
+	while ((line = shell_pfs_out_peek ()) != 0)
+	{
+		len = strlen (line);
+		if (zip_len + len > SHELL_PFS_ZIP_BLOCK)
+			break;		// block full
+		if (zip_len == 0)
+			zip_start = HAL_GetTick ();
+		memcpy (&zip_in[zip_hist + zip_len], line, len);
+		zip_len += len;
+		shell_pfs_out_drop ();
+	}
+
+	if ((zip_len == 0) || ((line == 0) && (HAL_GetTick () - zip_start < SHELL_PFS_ZIP_MS)))
+		return 0;		// nothing to send, or still gathering
+	if ((link == 0) || link->busy () || (shell_state.busy != 0) || (shell_fp == shell_state_output))
+		return 0;
+
+	// Compress, check, frame and send
+	if ((zip_frame % SHELL_PFS_ZIP_SYNC == 0) || (link != zip_link))
+	{
+		memmove (zip_in, &zip_in[zip_hist], zip_len);		// frame without history
+		zip_hist = 0;
+		zip_frame = 0;
+	}
+	n = shell_pfs_zip_compress (zip_in, zip_hist, zip_len, &zip_out[ZIP_HEADER], zip_head);
+	zip_out[0] = 0x5A;
+	zip_out[1] = 0xA5;
+	zip_out[2] = (zip_frame & 0x7F) | ((zip_hist != 0) ? 0x80 : 0);
+	zip_out[3] = n >> 8;
+	zip_out[4] = n & 0xFF;
+	n += ZIP_HEADER;
+	crc = shell_pfs_crc16 (zip_out, n, 0xFFFF);
+	zip_out[n++] = crc >> 8;
+	zip_out[n++] = crc & 0xFF;
+	zip_tx[0] = 0;
+	n = 1 + shell_pfs_cobs_encode (zip_out, n, &zip_tx[1]);
+	zip_tx[n++] = 0;
+	if (!link->send (zip_tx, n))
+		return 0;
+
+	shell_pfs_progress ();		// a frame went out
+	zip_link = link;
+	zip_frame++;
+	shell_pfs_zip_slide ();
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+// Compressed output still to send
+int shell_pfs_zip_busy ()
+{
+#ifdef SHELL_PFS_LINKS
+	return (zip_len != 0) || ((zip_link != 0) && zip_link->busy ());
+#else
+	return 0;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Command history and completion
+// A RAM-bounded ring of the last command lines, and completion of command names through the name
+// order of the lookup indexes : a TAB is a binary search on the typed prefix, no label is split.
+// Words naming submenus are followed from the current block, tracked from the lines typed at the
+// prompt. The application lists its indexes in shell_pfs_indexes (0-terminated) so submenus can be
+// completed too. Both need SHELL_PFS_RX : the lines are recorded, and TAB and the up / down arrows
+// work, at the prompt.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_HISTORY
+#define SHELL_PFS_HISTORY 4				// Lines kept in the history
+#endif
+#ifndef SHELL_PFS_HIST_LINE
+#define SHELL_PFS_HIST_LINE 48			// Longest line kept in the history
+#endif
+#ifndef SHELL_PFS_MENU_DEPTH
+#define SHELL_PFS_MENU_DEPTH 4			// Deepest submenu followed for completion
+#endif
+
+#ifdef SHELL_PFS_RX
+static char hist_lines[SHELL_PFS_HISTORY][SHELL_PFS_HIST_LINE];
+static int hist_count = 0;			// Lines added since startup
+static int hist_len = 0;			// Lines kept
+
+// Add a line (up to its end of line) to the history, unless it's empty or repeats the last one
+void shell_pfs_history_add (const char* line)
+{
+	char* dst = hist_lines[hist_count % SHELL_PFS_HISTORY];
+	int len;
+
+	for (len = 0; (line[len] != 0) && (line[len] != '\r') && (line[len] != '\n') && (len < SHELL_PFS_HIST_LINE - 1); len++);
+	if (len == 0)
+		return;
+	if ((hist_len > 0) && (strncmp (hist_lines[(hist_count - 1) % SHELL_PFS_HISTORY], line, len) == 0)
+			&& (hist_lines[(hist_count - 1) % SHELL_PFS_HISTORY][len] == 0))
+		return;
+
+	memcpy (dst, line, len);
+	dst[len] = 0;
+	hist_count++;
+	if (hist_len < SHELL_PFS_HISTORY)
+		hist_len++;
+}
+
+// History line : 1 is the most recent, 0 if there's none that old
+const char* shell_pfs_history (int n)
+{
+	if ((n < 1) || (n > hist_len))
+		return 0;
+
+	return hist_lines[(hist_count - n) % SHELL_PFS_HISTORY];
+}
+#endif
+
+extern t_shell_pfs_index* shell_pfs_indexes[];
+
+static t_shell_block_entry* menu_path[SHELL_PFS_MENU_DEPTH] = {(t_shell_block_entry*) root_block};	// Current block and its parents
+static int menu_depth = 0;
+
+// Index of a block, from shell_pfs_indexes. Returns 0 if none.
+t_shell_pfs_index* shell_pfs_index_of (t_shell_block_entry* block)
+{
+	int k;
+
+	for (k = 0; shell_pfs_indexes[k] != 0; k++)
+		if (shell_pfs_indexes[k]->block == block)
+			return shell_pfs_indexes[k];
+
+	return 0;
+}
+
+// Follow a line typed at the prompt as the shell does : into the submenus it names, or back with ".."
+void shell_pfs_menu_follow (const char* line)
+{
+	t_shell_pfs_index* index;
+	t_shell_block_entry* entry;
+
+	for (;;)
+	{
+		while (*line == ' ')
+			line++;
+		if ((*line == 0) || (*line == '\r') || (*line == '\n'))
+			return;
+		if ((line[0] == '.') && (line[1] == '.'))
+		{
+			if (menu_depth > 0)
+				menu_depth--;
+			return;
+		}
+		index = shell_pfs_index_of (menu_path[menu_depth]);
+		entry = (index != 0) ? shell_pfs_lookup (index, line) : 0;
+		if ((entry == 0) || (entry->command_fp != 0) || (entry->block == 0) || (menu_depth == SHELL_PFS_MENU_DEPTH - 1))
+			return;		// a command (the rest are arguments), or a word the shell rejects
+		menu_path[++menu_depth] = entry->block;
+		while ((*line != 0) && (*line != ' '))
+			line++;
+	}
+}
+
+// Complete the last word of a partial command line ("len" characters) : the characters to append are
+// written to "out" (at most "size" - 1, terminated). Returns the number of matching commands : when
+// there's only one, the name is completed and followed by a space.
+int shell_pfs_complete (const char* line, int len, char* out, int size)
+{
+	t_shell_pfs_index* index = shell_pfs_index_of (menu_path[menu_depth]);
+	t_shell_block_entry* entry;
+	const char *word, *first, *last;
+	int lo, hi, mid, n, k, wlen;
+
+	out[0] = 0;
+
+	// Follow the submenus named before the last word
+	word = line;
+	for (k = 0; k < len; k++)
+	{
+		if (line[k] != ' ')
+			continue;
+		if (&line[k] > word)
+		{
+			if (index == 0)
+				return 0;
+			entry = shell_pfs_lookup (index, word);
+			if ((entry == 0) || (entry->command_fp != 0) || (entry->block == 0))
+				return 0;		// unknown word, or a command : the rest are arguments
+			index = shell_pfs_index_of (entry->block);
+		}
+		word = &line[k + 1];
+	}
+	wlen = &line[len] - word;
+
+	if ((index == 0) || (index->names == 0))
+		return 0;
+	if (!index->ready)
+		shell_pfs_index_build (index);
+
+	// Binary search for the first name starting with the word
+	lo = 0;
+	hi = index->len;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (strncmp (index->block[index->names[mid]].label, word, wlen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (n = 0; (lo + n < index->len) && (strncmp (index->block[index->names[lo + n]].label, word, wlen) == 0); n++);
+	if (n == 0)
+		return 0;
+
+	// The names are sorted : what the first and last matches share, all matches share
+	first = index->block[index->names[lo]].label;
+	last = index->block[index->names[lo + n - 1]].label;
+	for (k = 0; (first[wlen + k] == last[wlen + k]) && (first[wlen + k] != 0) && (first[wlen + k] != ' ') && (k < size - 2); k++)
+		out[k] = first[wlen + k];
+	if (n == 1)
+		out[k++] = ' ';
+	out[k] = 0;
+
+	return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Interrupt-driven input : UART idle-line DMA reception into a lock-free ring
+// Define SHELL_PFS_RX (with SHELL_PFS_UART) to receive through a circular DMA buffer (the DMA channel must
+// be in circular mode) : the idle-line / half / full events copy new bytes into a single-producer,
+// single-consumer ring, so no keystroke is lost while a long command step runs.
+// shell_pfs_rx_poll drains the ring on the PFS's schedule : bytes go to binary mode or stop a stream,
+// and lines typed (or sent by a host tool) while a command runs are queued, with backspace editing, then
+// handed to the shell one at a time as it comes back to its prompt : a host doesn't need to wait for the
+// prompt between commands. When the queue is nearly full, SHELL_PFS_RX_FLOW(0) asks the host to pause
+// (XOFF by default, or define it to drive RTS) and SHELL_PFS_RX_FLOW(1) resumes once it has drained.
+// The shell receives keys through SHELL_PFS_RX_INPUT(c), which must be defined as the library's
+// character input function. With a data cache (H7), keep rx_dma non-cacheable.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef SHELL_PFS_RX
+
+#ifndef SHELL_PFS_RX_INPUT
+#error "SHELL_PFS_RX requires SHELL_PFS_RX_INPUT(c), the shell's character input function"
+#endif
+#ifndef SHELL_PFS_RX_DMA
+#define SHELL_PFS_RX_DMA 64			// Size of the circular DMA buffer
+#endif
+#ifndef SHELL_PFS_RX_RING
+#define SHELL_PFS_RX_RING 256		// Size of the ring (must be a power of two)
+#endif
+#ifndef SHELL_PFS_LINE
+#define SHELL_PFS_LINE 64			// Longest line
+#endif
+#ifndef SHELL_PFS_RX_QUEUE
+#define SHELL_PFS_RX_QUEUE 256		// Size of the queue of lines typed ahead
+#endif
+#ifndef SHELL_PFS_RX_FLOW
+#define SHELL_PFS_RX_FLOW(on) shell_pfs_rx_xonxoff (on)		// Flow control : returns 0 to retry later
+#endif
+
+static uint8_t rx_dma[SHELL_PFS_RX_DMA];
+static uint16_t rx_dma_pos = 0;				// Next byte to copy from rx_dma
+static uint8_t rx_ring[SHELL_PFS_RX_RING];
+static volatile unsigned int rx_head = 0;	// Written by the interrupt only
+static volatile unsigned int rx_tail = 0;	// Written by shell_pfs_rx_poll only
+uint32_t shell_pfs_rx_overruns = 0;			// Bytes lost because the ring was full
+
+static char rx_queue[SHELL_PFS_RX_QUEUE];	// Lines typed ahead, each ending with '\r'
+static int rx_queue_len = 0;
+static int rx_queue_edit = 0;				// Start of the line being typed
+static int rx_hold = 0;						// A line was just handed over : wait for the shell to take it
+static int rx_flow = 1;						// The host may send
+
+// With other links feeding the ring, its producers are serialized by masking interrupts
+#if defined (SHELL_PFS_USB_CDC) || defined (SHELL_PFS_RTT)
+#define RX_LOCK uint32_t primask = __get_PRIMASK (); __disable_irq ();
+#define RX_UNLOCK __set_PRIMASK (primask);
+#else
+#define RX_LOCK
+#define RX_UNLOCK
+#endif
+
+// Reception event (interrupt) : "pos" is the DMA's position in rx_dma
+void shell_pfs_rx_event (UART_HandleTypeDef* huart, uint16_t pos)
+{
+	if (huart != &SHELL_PFS_UART)
+		return;
+
+	RX_LOCK
+	shell_pfs_link_in = &uart_link;
+	while (rx_dma_pos != pos)
+	{
+		if (rx_head - rx_tail < SHELL_PFS_RX_RING)
+			rx_ring[rx_head++ % SHELL_PFS_RX_RING] = rx_dma[rx_dma_pos];
+		else
+			shell_pfs_rx_overruns++;
+		if (++rx_dma_pos == SHELL_PFS_RX_DMA)
+			rx_dma_pos = 0;
+		if (pos == SHELL_PFS_RX_DMA)		// the DMA reached the end of the buffer : copy up to the wrap-around
+			pos = 0;
+	}
+	RX_UNLOCK
+
+#ifdef SHELL_PFS_RTOS
+	shell_pfs_rtos_notify (SHELL_PFS_FLAG_RX);
+#endif
+}
+
+#if (USE_HAL_UART_REGISTER_CALLBACKS == 1)
+static void shell_pfs_rx_cb (UART_HandleTypeDef* huart, uint16_t pos)
+{
+	shell_pfs_rx_event (huart, pos);
+}
+#else
+void HAL_UARTEx_RxEventCallback (UART_HandleTypeDef* huart, uint16_t pos)
+{
+	shell_pfs_rx_event (huart, pos);
+}
+#endif
+
+#if defined (SHELL_PFS_USB_CDC) || defined (SHELL_PFS_RTT)
+// Input from another link (interrupt or main loop) : binary requests only, text goes to the UART
+static void shell_pfs_link_rx (const t_shell_pfs_transport* link, const uint8_t* data, int len)
+{
+	if (!shell_pfs_binary)
+		return;		// the shell would answer on its UART
+
+	RX_LOCK
+	shell_pfs_link_in = link;
+	for (; len > 0; len--)
+	{
+		if (rx_head - rx_tail < SHELL_PFS_RX_RING)
+			rx_ring[rx_head++ % SHELL_PFS_RX_RING] = *data++;
+		else
+			shell_pfs_rx_overruns++;
+	}
+	RX_UNLOCK
+
+#ifdef SHELL_PFS_RTOS
+	shell_pfs_rtos_notify (SHELL_PFS_FLAG_RX);
+#endif
+}
+#endif
+
+#ifdef SHELL_PFS_USB_CDC
+// USB input : call from CDC_Receive_FS (usbd_cdc_if.c)
+void shell_pfs_usb_rx (uint8_t* buf, uint32_t len)
+{
+	shell_pfs_link_rx (&usb_link, buf, len);
+}
+#endif
+
+// Start (or restart, after a reception error) the circular reception
+static void shell_pfs_rx_start ()
+{
+	rx_dma_pos = 0;
+#if (USE_HAL_UART_REGISTER_CALLBACKS == 1)
+	HAL_UART_RegisterRxEventCallback (&SHELL_PFS_UART, shell_pfs_rx_cb);
+#endif
+	HAL_UARTEx_ReceiveToIdle_DMA (&SHELL_PFS_UART, rx_dma, SHELL_PFS_RX_DMA);
+}
+
+// Next received byte, or -1 if none
+int shell_pfs_rx_getc ()
+{
+	if (rx_tail == rx_head)
+		return -1;
+
+	return rx_ring[rx_tail++ % SHELL_PFS_RX_RING];
+}
+
+// Add a key to the queue. Returns 0 if the queue is full.
+static int shell_pfs_rx_edit (char c)
+{
+	if ((c == '\b') || (c == 0x7F))
+	{
+		if (rx_queue_len > rx_queue_edit)
+			rx_queue_len--;
+	}
+	else if ((c == '\r') || (c == '\n'))
+	{
+		if (rx_queue_len == SHELL_PFS_RX_QUEUE)
+			return 0;
+		rx_queue[rx_queue_len++] = '\r';
+		rx_queue_edit = rx_queue_len;
+	}
+	else if (c >= ' ')
+	{
+		if (rx_queue_len >= SHELL_PFS_RX_QUEUE - 1)
+			return 0;		// keep room for the end of line
+		if (rx_queue_len - rx_queue_edit < SHELL_PFS_LINE - 1)
+			rx_queue[rx_queue_len++] = c;
+	}
+
+	return 1;
+}
+
+// Default flow control : XON / XOFF, sent only between transfers. Returns 0 to retry later.
+int shell_pfs_rx_xonxoff (int on)
+{
+	uint8_t c = on ? 0x11 : 0x13;
+
+	if ((shell_state.busy != 0) || (SHELL_PFS_UART.gState != HAL_UART_STATE_READY))
+		return 0;
+
+	return HAL_UART_Transmit (&SHELL_PFS_UART, &c, 1, 1) == HAL_OK;
+}
+
+static char rx_prompt[SHELL_PFS_LINE];		// Copy of the line being typed at the prompt
+static int rx_prompt_len = 0;
+static int rx_esc = 0;						// Escape sequence progress : 1 after ESC, 2 after ESC [
+static int rx_hist = 0;						// History line being shown, 0 for a new line
+
+int shell_pfs_run_immediate (const char* line);		// Prompt fast path (see "command chaining and scripts")
+void shell_pfs_immediate_poll ();
+
+// Pass a key to the shell, keeping track of the prompt line
+static void shell_pfs_rx_type (char c)
+{
+	if ((c == '\b') || (c == 0x7F))
+	{
+		if (rx_prompt_len > 0)
+			rx_prompt_len--;
+	}
+	else if ((c == '\r') || (c == '\n'))
+		rx_prompt_len = 0;
+	else if ((c >= ' ') && (rx_prompt_len < SHELL_PFS_LINE - 1))
+		rx_prompt[rx_prompt_len++] = c;
+
+	SHELL_PFS_RX_INPUT(c);
+}
+
+// Replace the prompt line, by erasing it key by key : the shell keeps editing it itself
+static void shell_pfs_rx_replace (const char* line)
+{
+	while (rx_prompt_len > 0)
+		shell_pfs_rx_type ('\b');
+	for (; (line != 0) && (*line != 0); line++)
+		shell_pfs_rx_type (*line);
+}
+
+// Handle a key at the prompt : history (up / down arrows), completion (TAB) and line tracking
+static void shell_pfs_rx_prompt (char c)
+{
+	char ext[SHELL_PFS_HIST_LINE];
+	int k;
+
+	if (rx_esc == 1)
+	{
+		rx_esc = (c == '[') ? 2 : 0;
+		return;
+	}
+	if (rx_esc == 2)
+	{
+		rx_esc = 0;
+		if ((c == 'A') && (shell_pfs_history (rx_hist + 1) != 0))
+			shell_pfs_rx_replace (shell_pfs_history (++rx_hist));
+		else if ((c == 'B') && (rx_hist > 0))
+			shell_pfs_rx_replace (shell_pfs_history (--rx_hist));
+		return;
+	}
+
+	if (c == 0x1B)
+		rx_esc = 1;
+	else if (c == '\t')
+	{
+		shell_pfs_complete (rx_prompt, rx_prompt_len, ext, sizeof (ext));
+		for (k = 0; ext[k] != 0; k++)
+			shell_pfs_rx_type (ext[k]);
+	}
+	else
+	{
+		if ((c == '\r') || (c == '\n'))
+		{
+			rx_prompt[rx_prompt_len] = 0;
+			shell_pfs_history_add (rx_prompt);
+			shell_pfs_menu_follow (rx_prompt);
+			if (shell_pfs_run_immediate (rx_prompt))
+				shell_pfs_rx_replace ("");		// done : the shell only gets an empty line
+			rx_hist = 0;
+		}
+		shell_pfs_rx_type (c);
+	}
+}
+
+// Distribute received bytes (part of shell_pfs_poll)
+void shell_pfs_rx_poll ()
+{
+	int c, k, n;
+
+	if (SHELL_PFS_UART.RxState == HAL_UART_STATE_READY)
+		shell_pfs_rx_start ();		// reception stopped (first call, or a UART error)
+	shell_pfs_immediate_poll ();
+
+#ifdef SHELL_PFS_RTT
+	{
+		uint8_t buf[16];
+
+		n = SHELL_PFS_RX_RING - (rx_head - rx_tail);
+		n = SEGGER_RTT_Read (0, buf, (n < (int) sizeof (buf)) ? n : (int) sizeof (buf));
+		if (n > 0)
+			shell_pfs_link_rx (&rtt_link, buf, n);
+	}
+#endif
+
+	// Back at the prompt : hand over the next queued line. The shell gets a turn to dispatch it
+	// before anything else is handed over.
+	if (rx_hold)
+		rx_hold = 0;
+	else if ((shell_state.command_fp == 0) && (shell_fp != shell_state_output) && (rx_queue_len > 0))
+	{
+		for (n = 0; (n < rx_queue_len) && (rx_queue[n] != '\r'); n++);
+		if (n < rx_queue_len)
+			n++;		// complete line : hand over its end of line too
+		for (k = 0; k < n; k++)
+			shell_pfs_rx_prompt (rx_queue[k]);
+
+		memmove (rx_queue, &rx_queue[n], rx_queue_len - n);
+		rx_queue_len -= n;
+		rx_queue_edit = (rx_queue_edit > n) ? rx_queue_edit - n : 0;
+		rx_hold = 1;
+	}
+
+	while ((c = shell_pfs_rx_getc ()) >= 0)
+	{
+		if (shell_pfs_binary)
+			shell_pfs_bin_rx (c);
+		else if (shell_pfs_streaming)
+			shell_pfs_stream_stop ();		// any key ends a stream
+		else if ((shell_state.command_fp == 0) && (rx_queue_len == 0) && !rx_hold)
+		{
+			shell_pfs_rx_prompt (c);		// at the prompt : the shell handles the key itself
+			if ((c == '\r') || (c == '\n'))
+				rx_hold = 1;				// the rest waits until the shell has taken the line
+		}
+		else if (!shell_pfs_rx_edit (c))	// a command is running : queue the key for later
+		{
+			rx_tail--;		// queue full : leave the key in the ring
+			break;
+		}
+	}
+
+	// Backpressure : pause the host when the queue can't take another line, resume once it has drained
+	if (rx_flow && (rx_queue_len > SHELL_PFS_RX_QUEUE - SHELL_PFS_LINE) && SHELL_PFS_RX_FLOW(0))
+		rx_flow = 0;
+	else if (!rx_flow && (rx_queue_len < SHELL_PFS_RX_QUEUE / 2) && SHELL_PFS_RX_FLOW(1))
+		rx_flow = 1;
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Initialization and polling : call shell_pfs_init once at startup, after the HAL and the shell,
+// then shell_pfs_poll from the main loop, next to the shell's own polling
+/////////////////////////////////////////////////////////////////////////////////////
+
+void shell_pfs_init ()
+{
+	shell_pfs_cycles_init ();
+	shell_pfs_budget = SHELL_PFS_STEP_BUDGET_US * (SystemCoreClock / 1000000);
+#ifdef SHELL_PFS_TRACE
+	shell_pfs_trace_init ();
+#endif
+}
+
+void shell_pfs_poll ()
+{
+	shell_pfs_flush ();		// text the foreground command appended before yielding
+#ifdef SHELL_PFS_TRACE
+	if (shell_pfs_trace_out && (shell_state.busy == 0) && (shell_fp != shell_state_output))
+	{
+		shell_pfs_trace_out = 0;
+		TRACE(TRACE_SENT, 0)
+	}
+#endif
+#ifdef SHELL_PFS_RX
+	shell_pfs_rx_poll ();
+#endif
+	shell_pfs_jobs_poll ();
+	shell_pfs_watchdog ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Idle detection : how long the shell can be left alone
+// Everything the shell and its commands do is either runnable now, sleeping until a HAL tick deadline
+// (SLEEP), or waiting for an interrupt (UART input or end of transmission). shell_pfs_wait_time sums this
+// up, so an RTOS task or a low-power main loop only polls the shell when there is something to do.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_POLL_MS
+#define SHELL_PFS_POLL_MS 10				// Input polling period when the shell receives without SHELL_PFS_RX
+#endif
+
+// Time left before a job must run again : 0 if it's runnable, its wake-up delay if it's sleeping
+static uint32_t shell_pfs_job_wait (t_shell_pfs_job* job, void (*fp)())
+{
+	int32_t ms;
+
+	if (fp == 0)
+		return SHELL_PFS_WAIT_FOREVER;		// no command
+	if (fp != shell_pfs_sleep_wait)
+		return 0;
+
+	ms = (int32_t) (job->wake_tick - HAL_GetTick ());
+	return (ms > 0) ? (uint32_t) ms : 0;
+}
+
+// Milliseconds the shell can wait without being polled : 0 if something is runnable now,
+// SHELL_PFS_WAIT_FOREVER if only input can give it work
+uint32_t shell_pfs_wait_time ()
+{
+	uint32_t ms, t;
+	int k;
+
+	if ((shell_fp == shell_state_output) || ((shell_pfs_out_pending () != 0) && (shell_state.busy == 0)) || shell_pfs_streaming)
+		return 0;		// output to hand over, or a stream to keep fed
+	if (shell_pfs_zip_busy ())
+		return 0;		// compressed output to send
+#ifdef SHELL_PFS_RX
+	if (rx_head != rx_tail)
+		return 0;		// input to distribute
+	if ((shell_state.command_fp == 0) && (rx_queue_len > 0))
+		return 0;		// queued lines to hand to the prompt
+#endif
+
+	// Foreground and background commands
+	ms = shell_pfs_job_wait (&shell_pfs_jobs[0], shell_state.command_fp);
+	if ((shell_state.command_fp == shell_pfs_out_drain) && (shell_state.busy != 0))
+		ms = SHELL_PFS_WAIT_FOREVER;		// only waiting for the last line to go
+	for (k = 1; k <= SHELL_PFS_MAX_JOBS; k++)
+	{
+		t = shell_pfs_job_wait (&shell_pfs_jobs[k], shell_pfs_jobs[k].fp);
+		if (t < ms)
+			ms = t;
+	}
+
+	if ((shell_state.busy != 0) && (ms > 1))
+		ms = 1;			// the end of a transmission may not be signaled : check again soon
+#ifndef SHELL_PFS_RX
+	if ((shell_state.command_fp == 0) && (ms > SHELL_PFS_POLL_MS))
+		ms = SHELL_PFS_POLL_MS;		// the shell receives on its own : poll it
+#endif
+#ifdef SHELL_PFS_WDG_KICK
+	if (ms > SHELL_PFS_WDG_MS / 2)
+		ms = SHELL_PFS_WDG_MS / 2;	// back in time to kick the watchdog
+#endif
+
+	return ms;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Low-power idle : let the MCU sleep between polls
+// shell_pfs_idle_state tells the application how deeply it may sleep. While a transfer is in flight only
+// WFI is safe (the UART and its DMA must keep running). Otherwise nothing is lost by stopping the clocks :
+// the application may enter STOP with UART wake-up and a wake-up timer for the SLEEP deadline, then
+// restore its clocks before polling again. shell_pfs_idle does all of this from the main loop, using
+// SHELL_PFS_DEEP_SLEEP(ms) when the application defines it and WFI otherwise.
+/////////////////////////////////////////////////////////////////////////////////////
+
+// How deeply the MCU can sleep, and for how long (*ms, SHELL_PFS_WAIT_FOREVER if only input can wake it)
+int shell_pfs_idle_state (uint32_t* ms)
+{
+	*ms = shell_pfs_wait_time ();
+	if (*ms == 0)
+		return SHELL_PFS_ACTIVE;
+
+	if (shell_state.busy != 0)
+		return SHELL_PFS_LIGHT;			// the shell is transmitting
+#ifdef SHELL_PFS_UART
+	if (SHELL_PFS_UART.gState != HAL_UART_STATE_READY)
+		return SHELL_PFS_LIGHT;			// DMA transmission (binary mode, streaming)
+#ifdef UART_FLAG_BUSY
+	if (__HAL_UART_GET_FLAG (&SHELL_PFS_UART, UART_FLAG_BUSY))
+		return SHELL_PFS_LIGHT;			// a character is coming in
+#endif
+#endif
+#ifndef SHELL_PFS_RX
+	if (shell_state.command_fp == 0)
+		return SHELL_PFS_LIGHT;			// the shell receives on its own : keep polling it
+#endif
+
+	return SHELL_PFS_DEEP;
+}
+
+// Sleep until the shell needs polling, from the main loop : shell_fp (); shell_pfs_poll (); shell_pfs_idle ();
+// Interrupts are masked between the check and the sleep so a wake-up can't slip in between (a pending
+// interrupt still ends WFI), and are serviced as soon as the MCU wakes up.
+void shell_pfs_idle ()
+{
+	uint32_t ms;
+	int depth;
+
+	__disable_irq ();
+	depth = shell_pfs_idle_state (&ms);
+	if (depth == SHELL_PFS_LIGHT)
+		__WFI ();
+	else if (depth == SHELL_PFS_DEEP)
+	{
+#ifdef SHELL_PFS_DEEP_SLEEP
+		SHELL_PFS_DEEP_SLEEP(ms);
+#else
+		__WFI ();
+#endif
+	}
+	__enable_irq ();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// RTOS integration : the shell as a low-priority task that blocks when it has nothing to do
+// Define SHELL_PFS_RTOS and create a thread running shell_pfs_task (after shell_pfs_init). Instead of
+// polling, the task blocks on its thread flags (the CMSIS-RTOS2 form of task notifications) until the
+// next SLEEP deadline, input (SHELL_PFS_RX) or the end of a transmission : call shell_pfs_tx_done from
+// HAL_UART_TxCpltCallback. Commands need no change, and cost nothing while asleep or idle.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef SHELL_PFS_RTOS
+
+static osThreadId_t shell_pfs_thread = 0;
+
+void shell_pfs_rtos_notify (uint32_t flags)
+{
+	if (shell_pfs_thread != 0)
+		osThreadFlagsSet (shell_pfs_thread, flags);
+}
+
+// Transmission complete : call from HAL_UART_TxCpltCallback (interrupt)
+void shell_pfs_tx_done ()
+{
+	shell_pfs_rtos_notify (SHELL_PFS_FLAG_TX);
+}
+
+// Shell task
+void shell_pfs_task (void* arg)
+{
+	uint32_t ms;
+
+	(void) arg;
+	shell_pfs_thread = osThreadGetId ();
+
+	for (;;)
+	{
+		ms = shell_pfs_wait_time ();
+		if (ms == SHELL_PFS_WAIT_FOREVER)
+			osThreadFlagsWait (SHELL_PFS_FLAG_RX | SHELL_PFS_FLAG_TX, osFlagsWaitAny, osWaitForever);
+		else if (ms != 0)
+			osThreadFlagsWait (SHELL_PFS_FLAG_RX | SHELL_PFS_FLAG_TX, osFlagsWaitAny, (ms * osKernelGetTickFreq () + 999) / 1000);
+
+		shell_fp ();
+		shell_pfs_poll ();
+	}
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : job control
+/////////////////////////////////////////////////////////////////////////////////////
+
+extern t_shell_pfs_index root_block_index;
+
+// Run a command of the root block in the background : "bg load"
+void command_bg ()
+{
+	t_shell_block_entry* entry = 0;
+	int n = 0;
+
+	if (shell_pfs_args () < 0)
+		return;
+
+	if (shell_pfs_argc > 1)
+		entry = shell_pfs_lookup (&root_block_index, shell_pfs_argv[1]);
+	if ((entry != 0) && (entry->command_fp != 0))
+		n = shell_pfs_job_start (entry->command_fp, shell_pfs_argc - 1, &shell_pfs_argv[1]);
+
+	if (n != 0)
+		shell_pfs_printf ("\r\n[%d] started", n);
+	else if (entry == 0)
+		shell_pfs_printf ("\r\nUsage : bg COMMAND [ARGS]");
+	else
+		shell_pfs_printf ("\r\nCan't start job");
+
+	DONE
+}
+
+// List the background jobs
+typedef struct
+{
+	int k;		// Job being listed
+} t_jobs_ctx;
+
+void command_jobs ()
+{
+	t_shell_pfs_job* job;
+
+	CONTEXT_MACHINE(t_jobs_ctx)
+	STATE 0:
+		ctx->k = 1;
+		state = 1;
+	STATE 1:		// one line per running job
+		if (ctx->k > SHELL_PFS_MAX_JOBS)
+		{
+			RETURN
+			break;
+		}
+		job = &shell_pfs_jobs[ctx->k];
+		if (job->fp != 0)
+			PRINT("\r\n[%d] %s%s", ctx->k, job->line, (job->fp == shell_pfs_sleep_wait) ? " (sleeping)" : "")
+		ctx->k++;
+	CONTEXT_MACHINE_END
+}
+
+// Stop a background job : "kill N"
+void command_kill ()
+{
+	long n;
+
+	if (shell_pfs_args () < 0)
+		return;
+
+	if (shell_pfs_arg_int (1, &n) && (n > 0) && (n <= SHELL_PFS_MAX_JOBS) && (shell_pfs_jobs[n].fp != 0))
+	{
+		shell_pfs_jobs[n].fp = 0;
+		shell_pfs_ctx_release (&shell_pfs_jobs[n]);
+		shell_pfs_printf ("\r\n[%d] killed", (int) n);
+	}
+	else
+		shell_pfs_printf ("\r\nNo such job");
+
+	DONE
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : binary mode
+/////////////////////////////////////////////////////////////////////////////////////
+
+static t_shell_pfs_job bin_job;		// The requested command runs as a private job
+
+// Serve binary requests (see "Binary mode") until an empty request is received
+void command_bin ()
+{
+	static int leave;
+	t_shell_block_entry* block;
+	t_shell_block_entry* entry;
+	char* line;
+	unsigned int mark;
+	int n, k, len;
+
+	STATE_MACHINE
+	STATE 0:
+#ifndef SHELL_PFS_LINKS
+		PRINT("\r\nBinary mode needs a link (SHELL_PFS_UART)")
+		RETURN
+		break;
+#endif
+		PRINT("\r\nBinary mode")
+		state = 1;
+	STATE 1:		// wait for the text output to drain, then switch
+		if ((shell_pfs_out_pending () != 0) || (shell_state.busy != 0) || (shell_fp == shell_state_output))
+			break;
+		bin_rx_len = 0;
+		bin_rx_ready = 0;
+		leave = 0;
+		shell_pfs_binary = 1;
+		state = 2;
+	STATE 2:		// wait for a request, check it and find the command
+		if (!bin_rx_ready)
+		{
+			PROGRESS		// waiting on the host isn't being stuck
+			break;
+		}
+		n = (bin_rx_len > (int) sizeof (bin_rx)) ? -1 : shell_pfs_cobs_decode (bin_rx, bin_rx_len, bin_req, sizeof (bin_req));
+		bin_rx_len = 0;
+		bin_rx_ready = 0;
+		bin_resp_len = 1;
+		state = 4;		// send the response
+		if ((n < 2) || (shell_pfs_crc16 (bin_req, n, 0xFFFF) != 0))	// the CRC of data + CRC is 0
+		{
+			bin_resp[0] = BIN_BAD_CRC;
+			break;
+		}
+		n -= 2;
+		bin_resp[0] = BIN_OK;
+		if (n == 0)		// empty request : back to text mode
+		{
+			leave = 1;
+			break;
+		}
+
+		// Follow the path
+		block = (t_shell_block_entry*) root_block;
+		entry = 0;
+		for (k = 0; (k < n) && (entry == 0); k++)
+		{
+			if ((bin_req[k] == 0) || (bin_req[k] > shell_pfs_block_len (block)))
+				break;
+			entry = &block[bin_req[k]];
+			if ((entry->command_fp == 0) && (entry->block != 0))
+			{
+				block = entry->block;	// submenu : the next byte indexes it
+				entry = 0;
+			}
+		}
+		if ((entry == 0) || (entry->command_fp == 0))
+		{
+			bin_resp[0] = BIN_UNKNOWN;
+			break;
+		}
+
+		// Rebuild a command line for ARGS : command name, then the arguments
+		line = bin_job.line;
+		for (len = 0; (entry->label[len] != 0) && (entry->label[len] != ' ') && (len < SHELL_PFS_JOB_LINE - 2); len++)
+			line[len] = entry->label[len];
+		line[len++] = ' ';
+		for (; (k < n) && (len < SHELL_PFS_JOB_LINE - 1); k++)
+			line[len++] = bin_req[k];
+		line[len] = 0;
+
+		bin_job.fp = entry->command_fp;
+		state = 3;
+	STATE 3:		// run the command, collecting its text output into the response
+		mark = shell_pfs_out_head;
+		n = shell_pfs_job_step (&bin_job);
+		for (k = 0; mark + k != shell_pfs_out_head; k++)		// its lines, at the end of the queue
+		{
+			line = shell_pfs_out_ring[(mark + k) % SHELL_PFS_OUT_SLOTS];
+			shell_pfs_bin_reply (line, strlen (line));
+		}
+		shell_pfs_out_head = mark;		// the background jobs' lines stay for the text console
+		if (!n)
+			state = 4;
+	STATE 4:
+		if (!shell_pfs_bin_send ())
+			break;
+		state = leave ? 5 : 2;
+	STATE 5:		// wait for the last response to leave, then back to the prompt
+#ifdef SHELL_PFS_LINKS
+		if ((shell_pfs_link_in != 0) && shell_pfs_link_in->busy ())
+			break;
+#endif
+		shell_pfs_binary = 0;
+		RETURN
+	STATE_MACHINE_END
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : profiling and step budget
+/////////////////////////////////////////////////////////////////////////////////////
+
+#define PROF_DEPTH 4		// Deepest submenu level listed by "prof"
+
+// List the profiling records along the command tree : "prof", or "prof reset" to clear them
+void command_prof ()
+{
+	static t_shell_block_entry* block[PROF_DEPTH];	// Blocks being walked, root first
+	static int index[PROF_DEPTH];					// Entry being listed in each block
+	static int depth;
+	static t_shell_pfs_prof* prof;					// Record being printed
+	t_shell_block_entry* entry;
+	t_shell_pfs_prof* rec;
+	char name[16];
+	int k;
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		if ((shell_pfs_argc > 1) && (strcmp (shell_pfs_argv[1], "reset") == 0))
+		{
+			for (rec = shell_pfs_prof_list; rec != 0; rec = rec->next)
+			{
+				rec->calls = rec->steps = rec->overruns = rec->max = 0;
+				rec->total = 0;
+			}
+			RETURN
+			break;
+		}
+#ifndef SHELL_PFS_PROFILING
+		PRINT("\r\nProfiling is disabled (define SHELL_PFS_PROFILING)")
+		RETURN
+		break;
+#endif
+		block[0] = (t_shell_block_entry*) root_block;
+		index[0] = 0;
+		depth = 0;
+		state = 1;
+	STATE 1:		// next entry of the current block
+		if (++index[depth] > shell_pfs_block_len (block[depth]))
+		{
+			if (depth-- == 0)
+			{
+				RETURN		// done with the root block
+			}
+			break;
+		}
+		entry = &block[depth][index[depth]];
+		for (k = 0; (k < (int) sizeof (name) - 1) && (entry->label[k] != 0) && (entry->label[k] != ' '); k++)
+			name[k] = entry->label[k];
+		name[k] = 0;
+
+		if (entry->command_fp == 0)			// submenu : print its name and walk it
+		{
+			PRINT("\r\n%s%s", &"        "[8 - 2 * depth], name)
+			if ((entry->block != 0) && (depth < PROF_DEPTH - 1))
+			{
+				block[++depth] = entry->block;
+				index[depth] = 0;
+			}
+			break;
+		}
+
+		rec = shell_pfs_prof_find (entry->command_fp);
+		if (rec == 0)
+			break;		// never ran
+		PRINT("\r\n%s%s : %lu calls, %lu steps", &"        "[8 - 2 * depth], name, (unsigned long) rec->calls, (unsigned long) rec->steps)
+		prof = rec;
+		state = 2;
+	STATE 2:		// the rest of the record : a line slot can't hold it all
+		PRINT(", %lu cycles/step (max %lu)", (unsigned long) ((prof->steps != 0) ? prof->total / prof->steps : 0), (unsigned long) prof->max)
+		state = 3;
+	STATE 3:
+		PRINT(", %lu over budget", (unsigned long) prof->overruns)
+		state = 1;
+	STATE_MACHINE_END
+}
+
+// Show the step budget and overrun count, or set the budget : "budget [MICROSECONDS]"
+void command_budget ()
+{
+	long us;
+
+	if (shell_pfs_args () < 0)
+		return;
+
+	if (shell_pfs_arg_int (1, &us) && (us > 0))
+	{
+		shell_pfs_budget = us * (SystemCoreClock / 1000000);
+		shell_pfs_overruns = 0;
+	}
+	shell_pfs_printf ("\r\nStep budget %lu us, %lu steps over budget", (unsigned long) (shell_pfs_budget / (SystemCoreClock / 1000000)),
+			(unsigned long) shell_pfs_overruns);
+
+	DONE
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : history
+/////////////////////////////////////////////////////////////////////////////////////
+
+// List the history, oldest first
+void command_hist ()
+{
+	static int n;
+
+	STATE_MACHINE
+	STATE 0:
+#ifndef SHELL_PFS_RX
+		(void) n;
+		PRINT("\r\nHistory is recorded at the prompt (define SHELL_PFS_RX)")
+		RETURN
+		break;
+#else
+		n = SHELL_PFS_HISTORY;
+		state = 1;
+	STATE 1:
+		if (n == 0)
+		{
+			RETURN
+			break;
+		}
+		if (shell_pfs_history (n) != 0)
+			PRINT("\r\n%d  %s", n, shell_pfs_history (n))
+		n--;
+#endif
+	STATE_MACHINE_END
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : command chaining and scripts
+// "do CMD ; CMD ; ..." runs several commands from one line, "script NAME" runs a stored sequence from
+// shell_pfs_scripts (0-terminated, in flash or RAM, commands separated by ';' or line breaks).
+// The commands run one after the other as steps of a private job, with no prompt in between, and the
+// sequence ends with a single status line. A command reports a failure by setting shell_pfs_status :
+// the sequence stops there, as it does on an unknown command.
+// Commands listed in shell_pfs_immediate (0-terminated) do their whole job in one call : a sequence
+// runs them as soon as they're resolved and goes on to the next command in the same step, so a run
+// of GPIO commands costs one step instead of two per command. With SHELL_PFS_RX, one typed at the
+// prompt (in the current block) runs as soon as the line ends, and the shell only gets an empty line.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHELL_PFS_RUN_LINE
+#define SHELL_PFS_RUN_LINE 128			// Longest "do" line
+#endif
+
+typedef struct
+{
+	const char* name;
+	const char* text;		// Commands, separated by ';' or line breaks
+} t_shell_pfs_script;
+
+extern const t_shell_pfs_script shell_pfs_scripts[];
+extern void (* const shell_pfs_immediate[]) ();
+
+int shell_pfs_status = 0;		// Set by a command to report a failure (cleared before each command of a sequence)
+
+static t_shell_pfs_job run_job;			// Command of the sequence being run
+static const char* run_text = 0;		// Rest of the sequence, 0 when no sequence is running
+static int run_count;					// Commands started so far
+static char run_buf[SHELL_PFS_RUN_LINE];	// Copy of the "do" line
+
+// Find the command named at the start of a line, following submenu names from the root.
+// Returns 0 if there's none, otherwise "*cmd" points at the command's name in the line.
+t_shell_block_entry* shell_pfs_resolve (const char* line, const char** cmd)
+{
+	t_shell_pfs_index* index = &root_block_index;
+	t_shell_block_entry* entry;
+
+	for (;;)
+	{
+		while (*line == ' ')
+			line++;
+		entry = shell_pfs_lookup (index, line);
+		if ((entry == 0) || (entry->command_fp != 0) || (entry->block == 0))
+			break;
+		if ((index = shell_pfs_index_of (entry->block)) == 0)
+			return 0;		// submenu without an index
+		while ((*line != 0) && (*line != ' '))
+			line++;
+	}
+
+	*cmd = line;
+	return entry;
+}
+
+// 1 if a command function is listed as immediate
+static int shell_pfs_is_immediate (void (*fp)())
+{
+	int k;
+
+	for (k = 0; shell_pfs_immediate[k] != 0; k++)
+		if (shell_pfs_immediate[k] == fp)
+			return 1;
+
+	return 0;
+}
+
+#ifdef SHELL_PFS_RX
+static t_shell_pfs_job imm_job;			// Immediate command run from the prompt
+
+// Run the command of a line typed at the prompt, if it's immediate. Returns 1 if it was started.
+int shell_pfs_run_immediate (const char* line)
+{
+	t_shell_pfs_index* index = shell_pfs_index_of (menu_path[menu_depth]);
+	t_shell_block_entry* entry;
+
+	while (*line == ' ')
+		line++;
+	if ((index == 0) || (imm_job.fp != 0) || (strlen (line) > SHELL_PFS_JOB_LINE - 1))
+		return 0;
+	entry = shell_pfs_lookup (index, line);
+	if ((entry == 0) || (entry->command_fp == 0) || !shell_pfs_is_immediate (entry->command_fp))
+		return 0;
+
+	strcpy (imm_job.line, line);
+	imm_job.fp = entry->command_fp;
+	shell_pfs_job_step (&imm_job);
+	return 1;
+}
+
+// Finish an immediate command that didn't end in its first call (output queue full)
+void shell_pfs_immediate_poll ()
+{
+	if (imm_job.fp != 0)
+		shell_pfs_job_step (&imm_job);
+}
+#endif
+
+// Start a sequence. Returns 0 if one is already running.
+static int shell_pfs_run_start (const char* text)
+{
+	if (run_text != 0)
+		return 0;
+
+	run_text = text;
+	run_count = 0;
+	run_job.fp = 0;
+	shell_pfs_status = 0;
+	return 1;
+}
+
+// Run one step of the sequence. Returns 0 once it has ended, or stopped on a failure (see shell_pfs_status).
+static int shell_pfs_run_step ()
+{
+	t_shell_block_entry* entry;
+	const char* cmd;
+	int len, n;
+
+	if (run_job.fp != 0)		// a command is running
+	{
+		if (!shell_pfs_job_step (&run_job) && (shell_pfs_status != 0))
+			return 0;
+		shell_pfs_out_pump ();
+		return 1;
+	}
+
+	for (;;)
+	{
+		// Next command : copy it to the job's line for its ARGS
+		while ((*run_text == ' ') || (*run_text == ';') || (*run_text == '\r') || (*run_text == '\n'))
+			run_text++;
+		if (*run_text == 0)
+			return 0;
+		for (len = 0; (run_text[len] != 0) && (run_text[len] != ';') && (run_text[len] != '\r') && (run_text[len] != '\n'); len++);
+		for (n = len; (n > 0) && (run_text[n - 1] == ' '); n--);
+		run_count++;
+		if (n > SHELL_PFS_JOB_LINE - 1)
+		{
+			shell_pfs_format (run_job.line, SHELL_PFS_JOB_LINE, "%s", run_text);		// for the report
+			run_text += len;
+			shell_pfs_status = -3;		// too long : the truncated command would run with other arguments
+			return 0;
+		}
+		memcpy (run_job.line, run_text, n);
+		run_job.line[n] = 0;
+		run_text += len;
+
+		if ((entry = shell_pfs_resolve (run_job.line, &cmd)) == 0)
+		{
+			shell_pfs_status = -1;		// unknown command
+			return 0;
+		}
+		if (entry->command_fp == shell_state.command_fp)
+		{
+			shell_pfs_status = -2;		// the sequence's own command : its state machine would re-enter itself
+			return 0;
+		}
+		memmove (run_job.line, cmd, strlen (cmd) + 1);		// drop the submenu names
+		shell_pfs_status = 0;
+		run_job.fp = entry->command_fp;
+
+		// Immediate command : run it now, and on to the next one unless it didn't end (output queue full)
+		if (!shell_pfs_is_immediate (run_job.fp) || shell_pfs_job_step (&run_job))
+			return 1;
+		if (shell_pfs_status != 0)
+			return 0;
+	}
+}
+
+// Print the status of the sequence and end it. Returns 0 if the output queue is full.
+static int shell_pfs_run_report ()
+{
+	int done;
+
+	if (shell_pfs_status == 0)
+		done = shell_pfs_printf ("\r\nOK, %d commands", run_count);
+	else if (shell_pfs_status == -2)
+		done = shell_pfs_printf ("\r\nCommand %d can't be nested : %s", run_count, run_job.line);
+	else if (shell_pfs_status == -3)
+		done = shell_pfs_printf ("\r\nCommand %d too long : %s...", run_count, run_job.line);
+	else if (shell_pfs_status < 0)
+		done = shell_pfs_printf ("\r\nUnknown command %d : %s", run_count, run_job.line);
+	else
+		done = shell_pfs_printf ("\r\nCommand %d failed (%d) : %s", run_count, shell_pfs_status, run_job.line);
+
+	if (done)
+		run_text = 0;
+	return done;
+}
+
+// Run commands one after the other : "do led ; flash 3 ; cnt"
+void command_do ()
+{
+	const char* line;
+
+	STATE_MACHINE
+	STATE 0:
+		line = (shell_pfs_job == &shell_pfs_jobs[0]) ? shell_state.input : shell_pfs_job->line;
+		for (; *line == ' '; line++);
+		for (; (*line != 0) && (*line != ' '); line++);		// skip "do"
+		shell_pfs_format (run_buf, sizeof (run_buf), "%s", line);
+		if (!shell_pfs_run_start (run_buf))
+		{
+			PRINT("\r\nA sequence is already running")
+			RETURN
+			break;
+		}
+		state = 1;
+	STATE 1:
+		if (shell_pfs_run_step ())
+			break;
+		state = 2;
+	STATE 2:
+		if (!shell_pfs_run_report ())
+			break;
+		RETURN
+	STATE_MACHINE_END
+}
+
+// Run a stored script : "script NAME", or "script" to list them
+void command_script ()
+{
+	static int k;
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		k = 0;
+		if (shell_pfs_argc < 2)
+		{
+			state = 3;
+			break;
+		}
+		for (; (shell_pfs_scripts[k].name != 0) && (strcmp (shell_pfs_scripts[k].name, shell_pfs_argv[1]) != 0); k++);
+		if (shell_pfs_scripts[k].name == 0)
+		{
+			PRINT("\r\nUnknown script")
+			RETURN
+			break;
+		}
+		if (!shell_pfs_run_start (shell_pfs_scripts[k].text))
+		{
+			PRINT("\r\nA sequence is already running")
+			RETURN
+			break;
+		}
+		state = 1;
+	STATE 1:
+		if (shell_pfs_run_step ())
+			break;
+		state = 2;
+	STATE 2:
+		if (!shell_pfs_run_report ())
+			break;
+		RETURN
+		break;
+	STATE 3:		// list the scripts
+		if (shell_pfs_scripts[k].name == 0)
+		{
+			RETURN
+			break;
+		}
+		PRINT("\r\n%s", shell_pfs_scripts[k].name)
+		k++;
+	STATE_MACHINE_END
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : memory access
+// "peek", "poke" and "dump" read and write memory and peripheral registers with the access width
+// given as their last argument : b (8 bits), h (16 bits) or w (32 bits, the default), since many
+// peripherals only accept accesses of their register's width. "dump" streams its hex lines through
+// the link when there's one (see "Transports"), so large buffers go out at its line rate; in binary mode
+// it replies with the raw bytes instead. Addresses aren't checked : a bad one faults like a bad pointer.
+/////////////////////////////////////////////////////////////////////////////////////
+
+#define DUMP_LINE 16		// Bytes per line of "dump"
 
-#include "main.h"	// For the HAL
+static uintptr_t dump_addr;		// Next address to dump
+static uintptr_t dump_end;
+static int dump_width;
 
-#include <stdio.h>
-#include <string.h>	// For strlen
+// Access width from the optional argument "n" : 1, 2 or 4 bytes, 0 if invalid
+static int mem_width (int n)
+{
+	if (n >= shell_pfs_argc)
+		return 4;
+	if (strcmp (shell_pfs_argv[n], "b") == 0)
+		return 1;
+	if (strcmp (shell_pfs_argv[n], "h") == 0)
+		return 2;
+	if (strcmp (shell_pfs_argv[n], "w") == 0)
+		return 4;
+	return 0;
+}
 
-// Macros for programming command functions more easily :
-// Start a state machine:
-#define STATE_MACHINE static int state = 0; switch (state) {
-// Start a state machine state:
-#define STATE break; case
-// End a state machine:
-#define STATE_MACHINE_END }
-// Return from state machine (can be used in any state) :
-#define RETURN state = 0; shell_fp = shell_state_output; shell_state.command_fp = 0;
-// End a command function:
-#define DONE shell_fp = shell_state_output; shell_state.command_fp = 0;
+// Read one item, with an access of its own width
+static uint32_t mem_read (uintptr_t addr, int width)
+{
+	if (width == 1)
+		return *(volatile uint8_t*) addr;
+	if (width == 2)
+		return *(volatile uint16_t*) addr;
+	return *(volatile uint32_t*) addr;
+}
 
-// LED control macro. This is hardware specific, make sure "LED" refers to the correct pin on your target.
-// If your board doesn't have an LED, define SHELL_NO_LED to replace with a dummy macro
-#ifndef SHELL_NO_LED
-#define LED(a) HAL_GPIO_WritePin(LED_GPIO_Port, LED_Pin, ((a) == 1) ? GPIO_PIN_SET : GPIO_PIN_RESET)
+// Write one item, with an access of its own width
+static void mem_write (uintptr_t addr, int width, uint32_t value)
+{
+	if (width == 1)
+		*(volatile uint8_t*) addr = value;
+	else if (width == 2)
+		*(volatile uint16_t*) addr = value;
+	else
+		*(volatile uint32_t*) addr = value;
+}
+
+// Parse "ADDR" and the width argument "n". Returns 0 if they're missing, invalid or misaligned.
+static int mem_args (uintptr_t* addr, int* width, int n)
+{
+	long a;
+
+	*width = mem_width (n);
+	if (!shell_pfs_arg_int (1, &a) || (*width == 0))
+		return 0;
+	*addr = (uintptr_t) (unsigned long) a;
+	return (*addr % *width) == 0;
+}
+
+// Format the dump line at dump_addr. Returns its length.
+static int dump_line (char* buf, int size)
+{
+	uintptr_t a;
+	int n;
+
+	n = shell_pfs_format (buf, size, "\r\n%08lx:", (unsigned long) dump_addr);
+	for (a = dump_addr; (a < dump_addr + DUMP_LINE) && (a < dump_end); a += dump_width)
+		n += shell_pfs_format (&buf[n], size - n, (dump_width == 1) ? " %02lx" : ((dump_width == 2) ? " %04lx" : " %08lx"),
+				(unsigned long) mem_read (a, dump_width));
+	return n;
+}
+
+// Stream producer : as many dump lines as fit
+static int dump_producer (uint8_t* buf, int size)
+{
+	int n = 0;
+
+	while ((dump_addr < dump_end) && (n + 64 <= size))		// 64 bytes : room for the longest line
+	{
+		n += dump_line ((char*) &buf[n], size - n);
+		dump_addr += DUMP_LINE;
+	}
+
+	return n;
+}
+
+// Read an item : "peek ADDR [b|h|w]"
+void command_peek ()
+{
+	uintptr_t addr;
+	uint32_t value;
+	int width;
+
+	if (shell_pfs_args () < 0)
+		return;
+
+	if (!mem_args (&addr, &width, 2))
+		shell_pfs_printf ("\r\nUsage : peek ADDR [b|h|w]");
+	else
+	{
+		value = mem_read (addr, width);
+		if (!shell_pfs_bin_reply (&value, width))
+			shell_pfs_printf ("\r\n%08lx: %lx", (unsigned long) addr, (unsigned long) value);
+	}
+
+	DONE
+}
+
+// Write an item, then read it back : "poke ADDR VALUE [b|h|w]"
+void command_poke ()
+{
+	uintptr_t addr;
+	uint32_t value;
+	long v;
+	int width;
+
+	if (shell_pfs_args () < 0)
+		return;
+
+	if (!mem_args (&addr, &width, 3) || !shell_pfs_arg_int (2, &v))
+		shell_pfs_printf ("\r\nUsage : poke ADDR VALUE [b|h|w]");
+	else
+	{
+		mem_write (addr, width, (uint32_t) v);
+		value = mem_read (addr, width);
+		if (!shell_pfs_bin_reply (&value, width))
+			shell_pfs_printf ("\r\n%08lx: %lx", (unsigned long) addr, (unsigned long) value);
+	}
+
+	DONE
+}
+
+// Dump a memory range : "dump ADDR LEN [b|h|w]"
+void command_dump ()
+{
+	static char line[64];
+	uint32_t value;
+	int width;
+	long len;
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		if (!mem_args (&dump_addr, &width, 3) || !shell_pfs_arg_int (2, &len) || (len <= 0))
+		{
+			PRINT("\r\nUsage : dump ADDR LEN [b|h|w]")
+			RETURN
+			break;
+		}
+		if (len % width != 0)		// the last access would read past the range
+		{
+			PRINT("\r\nLEN must be a multiple of %d", width)
+			RETURN
+			break;
+		}
+		dump_width = width;
+		dump_end = dump_addr + len;
+		if (shell_pfs_binary)		// raw bytes, as far as the response frame goes
+		{
+			for (; dump_addr < dump_end; dump_addr += dump_width)
+			{
+				value = mem_read (dump_addr, dump_width);
+				if (shell_pfs_bin_reply (&value, dump_width) < 0)
+					break;		// frame full : status BIN_OVERFLOW, no need to read on
+			}
+			RETURN
+			break;
+		}
+		state = 1;
+	STATE 1:		// take over the UART once the shell's output is done
+		if ((shell_pfs_out_pending () != 0) || (shell_fp == shell_state_output))
+			break;
+		if (shell_pfs_stream_start (dump_producer))
+			state = 2;
+		else if (shell_state.busy == 0)		// no link : one line at a time through the output queue
+			state = 3;
+	STATE 2:		// keep the DMA buffers full until the end of the range
+		if (!shell_pfs_stream_poll ())
+		{
+			RETURN
+		}
+	STATE 3:
+		if (dump_addr >= dump_end)
+		{
+			RETURN
+			break;
+		}
+		dump_line (line, sizeof (line));
+		PRINT("%s", line)
+		dump_addr += DUMP_LINE;
+	STATE_MACHINE_END
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : links
+/////////////////////////////////////////////////////////////////////////////////////
+
+// List the links, or choose the one for bulk output : "link [NAME|auto]"
+void command_link ()
+{
+	static int k;
+	const t_shell_pfs_transport* link;
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		k = 0;
+		state = 1;
+		if (shell_pfs_argc < 2)
+			break;
+		if (strcmp (shell_pfs_argv[1], "auto") == 0)
+			shell_pfs_link_forced = 0;
+		else
+		{
+			for (; (shell_pfs_links[k] != 0) && (strcmp (shell_pfs_links[k]->name, shell_pfs_argv[1]) != 0); k++);
+			if (shell_pfs_links[k] == 0)
+			{
+				PRINT("\r\nUnknown link")
+				RETURN
+				break;
+			}
+			shell_pfs_link_forced = shell_pfs_links[k];
+			k = 0;
+		}
+	STATE 1:		// one line per link
+		if (shell_pfs_links[k] == 0)
+		{
+			RETURN
+			break;
+		}
+		link = shell_pfs_links[k];
+		PRINT("\r\n%s %s%s%s", (link == shell_pfs_link ()) ? "*" : " ", link->name, link->up () ? "" : " (down)",
+				link->busy () ? " (busy)" : "")
+		k++;
+	STATE_MACHINE_END
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : compressed output
+/////////////////////////////////////////////////////////////////////////////////////
+
+// Turn compressed output on or off : "zip on|off" (decode with host/shell_pfs_unzip.c)
+void command_zip ()
+{
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		if ((shell_pfs_argc > 1) && (strcmp (shell_pfs_argv[1], "off") == 0))
+		{
+			state = 2;
+			break;
+		}
+#ifdef SHELL_PFS_LINKS
+		if ((shell_pfs_argc > 1) && (strcmp (shell_pfs_argv[1], "on") == 0) && (shell_pfs_link () != 0))
+		{
+			PRINT("\r\nCompressed output on")
+			state = 1;
+			break;
+		}
+#endif
+		PRINT("\r\nUsage : zip on|off (needs a link)")
+		RETURN
+		break;
+	STATE 1:		// switch once this line is out, so it stays readable
+		if ((shell_pfs_out_pending () != 0) || (shell_state.busy != 0) || (shell_fp == shell_state_output))
+			break;
+		shell_pfs_zip_reset ();
+		shell_pfs_zip = 1;
+		RETURN
+		break;
+	STATE 2:		// switch once the compressed output is out
+		if (shell_pfs_zip_busy ())
+			break;
+		shell_pfs_zip = 0;
+		PRINT("\r\nCompressed output off")
+		RETURN
+	STATE_MACHINE_END
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : trace
+/////////////////////////////////////////////////////////////////////////////////////
+
+// Print the trace, oldest first : "trace", or "trace on|off|clear". Recording pauses while it prints.
+void command_trace ()
+{
+#ifdef SHELL_PFS_TRACE
+	static const char* const names[] = {"reset", "run", "state", "end", "out", "sent", "wait", "sleep"};
+	static uint32_t k, t0;		// Record being printed, time of the first one
+	t_shell_pfs_trace_rec* rec;
+#endif
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+#ifndef SHELL_PFS_TRACE
+		PRINT("\r\nTracing is disabled (define SHELL_PFS_TRACE)")
+		RETURN
+		break;
 #else
-#define LED(a)
+		if (shell_pfs_argc > 1)
+		{
+			if (strcmp (shell_pfs_argv[1], "on") == 0)
+				shell_pfs_trace_buf.off = 0;
+			else if (strcmp (shell_pfs_argv[1], "off") == 0)
+				shell_pfs_trace_buf.off = 1;
+			else if (strcmp (shell_pfs_argv[1], "clear") == 0)
+				shell_pfs_trace_buf.head = 0;
+			RETURN
+			break;
+		}
+		shell_pfs_trace_buf.off = 1;
+		k = (shell_pfs_trace_buf.head > SHELL_PFS_TRACE_LEN) ? shell_pfs_trace_buf.head - SHELL_PFS_TRACE_LEN : 0;
+		t0 = shell_pfs_trace_buf.rec[k & (SHELL_PFS_TRACE_LEN - 1)].time;
+		PRINT("\r\n%lu events, cycles since the oldest :", (unsigned long) shell_pfs_trace_buf.head)
+		state = 1;
+	STATE 1:
+		if (k == shell_pfs_trace_buf.head)
+		{
+			shell_pfs_trace_buf.off = 0;
+			RETURN
+			break;
+		}
+		rec = &shell_pfs_trace_buf.rec[k & (SHELL_PFS_TRACE_LEN - 1)];
+		PRINT("\r\n%10lu %5s %5u  %lx", (unsigned long) (rec->time - t0), (rec->event < 8) ? names[rec->event] : "?",
+				(unsigned int) rec->arg, (unsigned long) (uintptr_t) rec->fp)
+		k++;
+#endif
+	STATE_MACHINE_END
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Built-in commands : memory footprint
+// "mem" lists the buffers of the PFS services (shell_pfs_mem_items, at the end of the file so it can
+// reach every one of them), the profiling records allocated so far and the command tables, walked
+// through their indexes. It is a report from the running image : the profiling records only exist for
+// the commands that ran, and the tables' labels and indexes come from the tables themselves. It leaves
+// out the stack, the shell library's own buffers and the scalars and small locals of the commands; the
+// linker map (or arm-none-eabi-size) gives the complete build-time figures.
+/////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	const char* name;
+	uint32_t size;
+} t_mem_item;
+
+extern const t_mem_item shell_pfs_mem_items[];
+
+// Report the RAM used by the PFS services, and the size and location of the command tables
+void command_mem ()
+{
+	static int k;
+	static uint32_t total, tables, labels, keys;
+	t_shell_pfs_index* index;
+	int j;
+#ifdef SHELL_PFS_PROFILING
+	t_shell_pfs_prof* prof;
+#endif
+
+	STATE_MACHINE
+	STATE 0:
+		k = 0;
+		total = 0;
+		state = 1;
+	STATE 1:		// one line per service
+		if (shell_pfs_mem_items[k].name == 0)
+		{
+			state = 2;
+			break;
+		}
+		PRINT("\r\n%5lu bytes RAM : %s", (unsigned long) shell_pfs_mem_items[k].size, shell_pfs_mem_items[k].name)
+		total += shell_pfs_mem_items[k].size;
+		k++;
+	STATE 2:		// profiling records of the commands run so far
+#ifdef SHELL_PFS_PROFILING
+		for (j = 0, prof = shell_pfs_prof_list; prof != 0; prof = prof->next, j++);
+		PRINT("\r\n%5lu bytes RAM : profiling (%d commands)", (unsigned long) (j * sizeof (t_shell_pfs_prof)), j)
+		total += j * sizeof (t_shell_pfs_prof);
+#endif
+		state = 3;
+	STATE 3:		// command tables, through their indexes
+		tables = labels = keys = 0;
+		for (k = 0; shell_pfs_indexes[k] != 0; k++)
+		{
+			index = shell_pfs_indexes[k];
+			if (!index->ready)
+				shell_pfs_index_build (index);		// a linked block's length is only known then
+			tables += (index->len + 1) * sizeof (t_shell_block_entry);
+			keys += index->len * (sizeof (t_shell_pfs_key) + ((index->names != 0) ? 1 : 0));
+			for (j = 0; j <= index->len; j++)
+				labels += strlen (index->block[j].label) + 1;
+		}
+		total += keys;
+#ifndef SHELL_PFS_FLASH_TABLES
+		total += tables;
 #endif
+		state = 4;
+	STATE 4:
+		PRINT("\r\n%5lu bytes RAM : indexes", (unsigned long) keys)
+		state = 5;
+	STATE 5:
+#ifdef SHELL_PFS_FLASH_TABLES
+		PRINT("\r\n%5lu bytes flash : command tables", (unsigned long) tables)
+#else
+		PRINT("\r\n%5lu bytes RAM : command tables", (unsigned long) tables)
+#endif
+		state = 6;
+	STATE 6:
+		PRINT("\r\n%5lu bytes flash : labels", (unsigned long) labels)
+		state = 7;
+	STATE 7:
+		PRINT("\r\n%5lu bytes RAM in total", (unsigned long) total)
+		RETURN
+	STATE_MACHINE_END
+}
 
 /////////////////////////////////////////////////////////////////////////////////////
 // Command functions : your application-specific commands are implemented here
@@ -75,7 +3571,7 @@ void command_cnt ()
 	switch (state)
 	{
 		case 0:
-			sprintf (shell_state.output, "\r\nCalled %i times", cnt);
+			shell_pfs_format (shell_state.output, SHELL_PFS_OUT_SLOT_LEN, "\r\nCalled %i times", cnt);
 			shell_fp = shell_state_output;		// Use the shell's own output function
 			state = 1;							// Transition to next state
 			break;								// Yield the CPU back to the application
@@ -95,8 +3591,8 @@ void command_cnt ()
 
 	STATE_MACHINE
 	STATE 0:
-		sprintf (shell_state.output, "\r\nCalled %i times", cnt);
-		shell_fp = shell_state_output;		// Use the shell's own output function
+		if (!shell_pfs_bin_reply (&cnt, sizeof (cnt)))	// In binary mode, reply with the raw value
+			PRINT("\r\nCalled %i times", cnt)		// Queue the line, the shell's output function sends it
 		state = 1;							// Transition to next state
 	STATE 1:
 		cnt++;
@@ -112,103 +3608,154 @@ void command_led_toggle ()
 {
 	HAL_GPIO_TogglePin(LED_GPIO_Port, LED_Pin);
 
-	// Transition back to the prompt
-	shell_fp = shell_state_output;	// transition to output state...
-	shell_state.command_fp = 0;		// ... but this command ends, so we'll be returning to the prompt
-
-	// DONE
+	DONE		// back to the prompt, or on to the next command of a sequence
 }
 
 // Demo function : designed to waste some time, display some stuff. Used for debugging the shell itself.
+// Its variables are in a context : several instances can run as background jobs ("bg load").
+typedef struct
+{
+	int cnt;					// Lines printed
+	int k;						// Progress of the time-wasting computation
+	volatile long long accu;	// Result of the time-wasting computation
+} t_load_ctx;
+
 void command_load ()
 {
-	static int cnt = 0;
-	static int state = 0;
-	static volatile long long accu = 0;
-	int k;
+	CONTEXT_MACHINE(t_load_ctx)
+	STATE 0:		// queue the counter's value as a string and increment
+		// Sent right away if the UART is idle, otherwise the line waits in the queue (and this state retries if it's full)
+		PRINT("\r\nValues : %i %li", ctx->cnt, (long) (ctx->accu / 10000))
+		ctx->cnt++;
+		state = 1;
+	STATE 1:		// end test
+		if (ctx->cnt == 500)
+		{
+			RETURN		// returns to the prompt once the queued lines are sent
+			break;
+		}
+		ctx->k = 0;
+		state = 2;
+	STATE 2:		// Do some time-wasting processing (load check), over as many steps as the budget requires
+		while ((ctx->k < 10000) && !OVER_BUDGET)
+		{
+			ctx->accu += ctx->k * ctx->cnt;
+			ctx->k++;
+		}
+		PROGRESS
+		if (ctx->k == 10000)
+			state = 0;		// loop back to keep counting
+	CONTEXT_MACHINE_END
+}
 
-	switch (state)
+// Demo function : a table of N values (default 100), 8 per row. The fields are appended to the output
+// (see shell_pfs_write) : the shell sends whole slots instead of one transfer per value.
+static int table_n, table_i;		// Values to print, values printed
+
+void command_table ()
+{
+	long n;
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		table_n = (shell_pfs_arg_int (1, &n) && (n > 0)) ? n : 100;
+		table_i = 0;
+		state = 1;
+	STATE 1:
+		for (; table_i < table_n; table_i++)
+			if (!shell_pfs_write (((table_i % 8) == 0) ? "\r\n%3d" : " %3d", table_i))
+				break;		// queue full : resume from this value on the next call
+		if (table_i == table_n)
+		{
+			RETURN
+		}
+	STATE_MACHINE_END
+}
+
+// Demo function : stream telemetry at the UART's full rate. "stream [N]" sends N samples (default 100000),
+// a real application would read its ADC buffer in the producer instead.
+static uint32_t stream_samples;		// Samples left to produce
+
+static int stream_demo_producer (uint8_t* buf, int size)
+{
+	int n = 0;
+
+	while ((stream_samples > 0) && (n + 16 <= size))		// 16 bytes : room for the longest line below
 	{
-		case 0:		// wait for previous DMA transfer to complete, and then transition
-			if (shell_state.busy == 0)
-				state = 1;
-			break;
-		case 1:		// send out the counter's value as a string and increment
-			// Print straight to the output buffer
-			sprintf (shell_state.output, "\r\nValues : %i %li", cnt++, (long) (accu / 10000));
-			shell_fp = shell_state_output;	// transition to output state
-			state = 2;	// transition to local state 2.
-			break;
-		case 2:		// end test
-			state = 0;		// loop back to keep counting or reset the state machine
-			if (cnt == 500)
-			{
-				cnt = 0;							// clear the counter
-				shell_fp = shell_state_output;	// transition to output state...
-				shell_state.command_fp = 0;		// ... but this command ends, so we'll be returning to the prompt
-			}
-			else
-			{
-				// Do some time-wasting processing (load check)
-				for (k = 0; k < 10000; k++)
-					accu += k * cnt;
-			}
-			break;
+		n += shell_pfs_format ((char*) &buf[n], size - n, "\r\n%lu %x", (unsigned long) stream_samples, (unsigned int) (SHELL_PFS_CYCLES () & 0xFFF));
+		stream_samples--;
 	}
 
+	return n;
+}
+
+void command_stream ()
+{
+	long n;
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		stream_samples = (shell_pfs_arg_int (1, &n) && (n > 0)) ? n : 100000;
+		state = 1;
+	STATE 1:		// take over the UART once the shell's output is done
+		if ((shell_pfs_out_pending () != 0) || (shell_fp == shell_state_output))
+			break;
+		if (shell_pfs_stream_start (stream_demo_producer))
+			state = 2;
+		else if (shell_state.busy == 0)		// UART free but no stream : there's no link
+		{
+			PRINT("\r\nStreaming needs a link (SHELL_PFS_UART)")
+			RETURN
+		}
+	STATE 2:		// keep the buffers full until the end of the stream
+		if (!shell_pfs_stream_poll ())
+		{
+			RETURN
+		}
+	STATE_MACHINE_END
 }
 
 // Demo function : flash LED "LD3" a number of times, with the number passed as command line argument
-// This demonstrates how to parse command line arguments
+// This demonstrates how to parse command line arguments, and how to wait without blocking the CPU
+
+#define FLASH_HALF_PERIOD 250	// LED on / off time, in milliseconds
 
 #ifndef USING_STATE_MACHINE_MACROS
 void command_flash ()
 {
 	static int state = 0;
-	static int arg = 0;
-	static int delay;		// Controls flashing speed of the LED
-	const int max_delay = 100000;
-	int rv = 0;
+	static long arg = 0;
 
 	switch (state)
 	{
 		case 0:		// parse the command line
-			rv = sscanf (shell_state.input, "flash %i", &arg);
-			if ((rv == 1) && (arg > 0))		// argument successfully decoded and non-zero ?
+			if (shell_pfs_args () < 0)
+				break;		// restarted as a background job
+			if (shell_pfs_arg_int (1, &arg) && (arg > 0))		// argument successfully decoded and non-zero ?
 				state++;	// Move on to next state
 			else
-				state = 6;	// Move on to final state (exits the command)
+				state = 4;	// Move on to final state (exits the command)
 			break;
 		case 1:		// turn on the LED
 			HAL_GPIO_WritePin(GPIOB, UCPD_DBn_Pin|LED_BLUE_Pin, GPIO_PIN_SET);
-			delay = max_delay;
-			state++;		// Move on to next state : delay loop
-			break;
-		case 2:		// delay loop
-			if (delay > 0)
-				delay--;	// decrement the delay
-			else
-				state++;	// delay elapsed : go to next state
+			shell_pfs_sleep (FLASH_HALF_PERIOD);	// the shell won't call us again until the delay has elapsed
+			state++;
 			break;
-		case 3:		// turn off the LED
+		case 2:		// turn off the LED
 			HAL_GPIO_WritePin(GPIOB, UCPD_DBn_Pin|LED_BLUE_Pin, GPIO_PIN_RESET);
-			delay = max_delay;
-			state++;		// Move on to next state : delay loop
+			shell_pfs_sleep (FLASH_HALF_PERIOD);
+			state++;
 			break;
-		case 4:		// delay loop
-			if (delay > 0)
-				delay--;	// decrement the delay
-			else
-				state++;	// delay elapsed : go to next state
-			break;
-		case 5:		// decrement arg and test for command completion
+		case 3:		// decrement arg and test for command completion
 			arg--;
 			if (arg == 0)
 				state++;	// exit
 			else
 				state = 1;	// loop back
 			break;
-		case 6:		// command complete, return to prompt
+		case 4:		// command complete, return to prompt
 			state = 0;		// reset for next time
 			shell_fp = shell_state_output;
 			shell_state.command_fp = 0;	// this command has ended
@@ -216,72 +3763,337 @@ void command_flash ()
 	}
 }
 #else
-// Same function but this time using macros
-void command_flash ()
+// Same function but this time using macros, and a context instead of statics
+typedef struct
 {
-	static int arg = 0;
-	static int delay;		// Controls flashing speed of the LED
-	const int max_delay = 10000000;	// 100000; way too short if running the H7 at 480 MHz with ICACHE and DCACHE !
-	int rv = 0;
+	long arg;		// Remaining flashes
+} t_flash_ctx;
 
-	STATE_MACHINE
+void command_flash ()
+{
+	CONTEXT_MACHINE(t_flash_ctx)
 	STATE 0:		// parse the command line
-		rv = sscanf (shell_state.input, "flash %i", &arg);
-		state = ((rv == 1) && (arg > 0)) ? 1 : 6;		// argument successfully decoded and non-zero ?
+		ARGS
+		state = (shell_pfs_arg_int (1, &ctx->arg) && (ctx->arg > 0)) ? 1 : 4;		// argument successfully decoded and non-zero ?
 	STATE 1:		// turn on the LED
 		LED(1);
-		delay = max_delay;
-		state++;		// Move on to next state : delay loop
-	STATE 2:		// delay loop
-		delay--;
-		state = (delay > 0) ? 2 : 3;
-	STATE 3:		// turn off the LED
+		SLEEP(FLASH_HALF_PERIOD)	// Timed by the HAL tick : independent of clock speed and caches
+		state++;
+	STATE 2:		// turn off the LED
 		LED(0);
-		delay = max_delay;
-		state++;		// Move on to next state : delay loop
-	STATE 4:		// delay loop
-		delay--;
-		state = (delay > 0) ? 4 : 5;
-	STATE 5:		// decrement arg and test for command completion
-		arg--;
-		state = (arg == 0) ? 6 : 1;
-	STATE 6:		// command complete, return to prompt
+		SLEEP(FLASH_HALF_PERIOD)
+		state++;
+	STATE 3:		// decrement arg and test for command completion
+		ctx->arg--;
+		state = (ctx->arg == 0) ? 4 : 1;
+	STATE 4:		// command complete, return to prompt
 		RETURN
-	STATE_MACHINE_END
+	CONTEXT_MACHINE_END
 }
 #endif
 
+// Benchmarks : a submenu of performance tests, reporting in CPU cycles (DWT) so builds can be compared
+// across STM32 families. Like command_load, these are for testing the shell itself.
+
+#define BENCH_LINE "\r\n0123456789ABCDEF0123456789ABCDEF0123456789ABCD"	// 48 bytes
+#define BENCH_LINE_LEN 48
+#define BENCH_MAX_BLOCK 64		// Largest block for the lookup benchmark
+
+// Output throughput : "tput [N]" sends N lines through the output queue (and shell_state_output's DMA),
+// then, if SHELL_PFS_UART is defined, the same bytes with blocking HAL transmits (no DMA).
+void command_bench_tput ()
+{
+	static long n;
+	static int sent;
+	static uint32_t t0;
+	static uint32_t dma_ms;
+	uint32_t ms;
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		if (!shell_pfs_arg_int (1, &n) || (n <= 0))
+			n = 100;
+		sent = 0;
+		t0 = HAL_GetTick ();
+		state = 1;
+	STATE 1:		// fill the queue as fast as it drains
+		PRINT(BENCH_LINE)
+		if (++sent == n)
+			state = 2;
+	STATE 2:		// wait for the last line to leave
+		if ((shell_pfs_out_pending () != 0) || (shell_state.busy != 0) || (shell_fp == shell_state_output))
+			break;
+		dma_ms = HAL_GetTick () - t0;
+		state = 3;
+	STATE 3:
+		PRINT("\r\nDMA : %lu bytes in %lu ms, %lu bytes/s", (unsigned long) (n * BENCH_LINE_LEN), (unsigned long) dma_ms,
+				(unsigned long) ((dma_ms != 0) ? (uint64_t) n * BENCH_LINE_LEN * 1000 / dma_ms : 0))
+		state = 4;
+	STATE 4:
+#ifdef SHELL_PFS_UART
+		if ((shell_pfs_out_pending () != 0) || (shell_state.busy != 0) || (shell_fp == shell_state_output))
+			break;
+		t0 = HAL_GetTick ();
+		for (sent = 0; sent < n; sent++)		// blocks the application for the whole transfer : it's a benchmark
+			HAL_UART_Transmit (&SHELL_PFS_UART, (uint8_t*) BENCH_LINE, BENCH_LINE_LEN, HAL_MAX_DELAY);
+		ms = HAL_GetTick () - t0;
+		PRINT("\r\nBlocking : %lu bytes in %lu ms, %lu bytes/s", (unsigned long) (n * BENCH_LINE_LEN), (unsigned long) ms,
+				(unsigned long) ((ms != 0) ? (uint64_t) n * BENCH_LINE_LEN * 1000 / ms : 0))
+#else
+		(void) ms;
+#endif
+		RETURN
+	STATE_MACHINE_END
+}
+
+// Scheduling overhead : "step [N]" measures the cycles between the end of a step and the start of the next
+// over N empty steps, i.e. the time the shell and the application loop take to come back to a command.
+void command_bench_step ()
+{
+	static long n;
+	static int count;
+	static uint32_t t_end;
+	static uint32_t max;
+	static uint64_t total;
+	uint32_t gap = SHELL_PFS_CYCLES () - t_end;
+
+	STATE_MACHINE
+	STATE 0:
+		ARGS
+		if (!shell_pfs_arg_int (1, &n) || (n <= 0))
+			n = 1000;
+		count = 0;
+		max = 0;
+		total = 0;
+		state = 1;
+	STATE 1:		// an empty step
+		if (count++ > 0)
+		{
+			total += gap;
+			if (gap > max)
+				max = gap;
+		}
+		if (count > n)
+			state = 2;
+	STATE 2:
+		PRINT("\r\n%lu steps : %lu cycles between steps on average, %lu max", (unsigned long) n,
+				(unsigned long) (total / n), (unsigned long) max)
+		RETURN
+	STATE_MACHINE_END
+
+	t_end = SHELL_PFS_CYCLES ();
+}
+
+// Synthetic command block for the lookup and dispatch benchmarks : "c00" to "c63"
+static t_shell_block_entry bench_block[BENCH_MAX_BLOCK + 1];
+static char bench_names[BENCH_MAX_BLOCK][4];
+static t_shell_pfs_key bench_keys[BENCH_MAX_BLOCK];
+static uint32_t bench_entry_t;		// cycle count when bench_nop was entered
+
+static void bench_nop ()
+{
+	bench_entry_t = SHELL_PFS_CYCLES ();
+}
+
+static void bench_block_init ()
+{
+	int k;
+
+	bench_block[0].label = "bench";
+	bench_block[0].command_fp = BLOCK_LEN BENCH_MAX_BLOCK;
+	for (k = 0; k < BENCH_MAX_BLOCK; k++)
+	{
+		shell_pfs_format (bench_names[k], sizeof (bench_names[k]), "c%02d", k);
+		bench_block[k + 1].label = bench_names[k];
+		bench_block[k + 1].command_fp = bench_nop;
+	}
+}
+
+// Reference : scan the first "len" entries and compare each label up to its first space
+static t_shell_block_entry* bench_scan (int len, const char* cmd)
+{
+	const char* l;
+	const char* c;
+	int k;
+
+	for (k = 1; k <= len; k++)
+	{
+		for (l = bench_block[k].label, c = cmd; (*l != 0) && (*l != ' ') && (*l == *c); l++, c++)
+			;
+		if (((*l == 0) || (*l == ' ')) && ((*c == 0) || (*c == ' ')))
+			return &bench_block[k];
+	}
+
+	return 0;
+}
+
+// Lookup time vs block size : average cycles to find every name of blocks of 4 to 64 commands,
+// with the hashed index and with a label scan
+void command_bench_lookup ()
+{
+	static int len;
+	t_shell_pfs_index index;
+	uint32_t t0, t_index, t_scan;
+	int k;
+
+	STATE_MACHINE
+	STATE 0:
+		bench_block_init ();
+		len = 4;
+		state = 1;
+	STATE 1:		// one block size per step
+		index.block = bench_block;
+		index.keys = bench_keys;
+		index.len = len;
+		index.ready = 0;
+		index.names = 0;
+		shell_pfs_lookup (&index, "");		// build the index outside of the measurement
+
+		t0 = SHELL_PFS_CYCLES ();
+		for (k = 0; k < len; k++)
+			shell_pfs_lookup (&index, bench_names[k]);
+		t_index = SHELL_PFS_CYCLES () - t0;
+
+		t0 = SHELL_PFS_CYCLES ();
+		for (k = 0; k < len; k++)
+			bench_scan (len, bench_names[k]);
+		t_scan = SHELL_PFS_CYCLES () - t0;
+
+		PRINT("\r\n%2d commands : index %lu cycles, scan %lu cycles", len, (unsigned long) (t_index / len),
+				(unsigned long) (t_scan / len))
+		len *= 2;
+		if (len > BENCH_MAX_BLOCK)
+			state = 2;
+	STATE 2:
+		RETURN
+	STATE_MACHINE_END
+}
+
+// Dispatch latency : cycles from a complete command line to the entry of its command function
+// (tokenize, look up in a 64-command block, call), with the hashed index and with a label scan.
+// Add the "step" overhead to get the delay between the Enter key and the first step of a command.
+void command_bench_disp ()
+{
+	static char line[16];
+	t_shell_pfs_index index = {bench_block, bench_keys, BENCH_MAX_BLOCK, 0, 0};
+	t_shell_block_entry* entry;
+	uint32_t t0, t_index, t_scan;
+
+	bench_block_init ();
+	shell_pfs_lookup (&index, "");		// build the index outside of the measurement
+
+	strcpy (line, "c47 12 0x10");
+	t0 = SHELL_PFS_CYCLES ();
+	shell_pfs_tokenize (line);
+	entry = shell_pfs_lookup (&index, shell_pfs_argv[0]);
+	entry->command_fp ();
+	t_index = bench_entry_t - t0;
+
+	strcpy (line, "c47 12 0x10");
+	t0 = SHELL_PFS_CYCLES ();
+	shell_pfs_tokenize (line);
+	entry = bench_scan (BENCH_MAX_BLOCK, shell_pfs_argv[0]);
+	entry->command_fp ();
+	t_scan = bench_entry_t - t0;
+
+	shell_pfs_printf ("\r\nDispatch : index %lu cycles, scan %lu cycles", (unsigned long) t_index, (unsigned long) t_scan);
+	DONE
+}
+
 
 /////////////// DEMONSTATION PFS - REMOVE FROM FINAL PRODUCT //////////////////////////////////////////////////
 
 // Demo root command block, should be declared by the application.
 // I need to come up with an initialization mechanism to get the pointer to the shell_state structure.
+// The demo blocks are linked blocks (see SHELL_PFS_BLOCK) : their entries are counted by the linker, with
+// the fragments in shell_pfs.ld (host/shell_pfs.ld for the host build), and listed in the order of their
+// command functions / submenus.
 // TEST ONLY : sub-blocks for navigation testing
-t_shell_block_entry level_2_block[] =
-{
-		{"Submenu 2", BLOCK_LEN 2, 0},	// Title block. Parent block is level 1 block
-		{"load - performance test", command_load, 0},		// Demo function
-		{"load - performance test", command_load, 0}		// Demo function
-};
+SHELL_PFS_BLOCK(level_2_block, "Submenu 2")	// Title block. Parent block is level 1 block
+SHELL_PFS_REGISTER(level_2_block, "load", "performance test", command_load)	// Demo function
 
-t_shell_block_entry level_1_block[] =
-{
-		{"Submenu 1", BLOCK_LEN 3, 0},	// Title block. Parent block is root.
-		{"load - performance test", command_load, 0},		// Demo function
-		{"load - performance test", command_load, 0},		// Demo function
-		{"sm2 - nested submenu example", 0, CMD_BLOCK level_2_block}
-};
+SHELL_PFS_BLOCK(level_1_block, "Submenu 1")	// Title block. Parent block is root.
+SHELL_PFS_REGISTER(level_1_block, "load", "performance test", command_load)	// Demo function
+SHELL_PFS_REGISTER_MENU(level_1_block, "sm2", "nested submenu example", level_2_block)
+
+SHELL_PFS_BLOCK(bench_block_menu, "Benchmarks")	// Title block. Parent block is root.
+SHELL_PFS_REGISTER(bench_block_menu, "tput [N]", "output throughput", command_bench_tput)
+SHELL_PFS_REGISTER(bench_block_menu, "step [N]", "scheduling overhead per step", command_bench_step)
+SHELL_PFS_REGISTER(bench_block_menu, "lookup", "command lookup time vs block size", command_bench_lookup)
+SHELL_PFS_REGISTER(bench_block_menu, "disp", "dispatch latency", command_bench_disp)
 
 // The application MUST declare root_block.
 // Its first entry's label will always appear at the start of the prompt and should be the device's name
-t_shell_block_entry root_block[] =
-{
-		{"STM32", BLOCK_LEN 5, 0},	// Title block. Root, so no parent block. No function. Function pointer replaced by command count in the block
-		{"sm1 - submenu example", 0, CMD_BLOCK level_1_block},	// Example of submenu declaration
-		{"led - toggles the blue LED", command_led_toggle, 0},
-		{"flash N - flash the LED 'N' times", command_flash, 0},
-		{"cnt - displays its own call count", command_cnt, 0},
-		{"load - performance test", command_load, 0}
+SHELL_PFS_BLOCK(root_block, "STM32")	// Title block. Root, so no parent block. No function. Function pointer replaced by the linker's command count
+SHELL_PFS_REGISTER_MENU(root_block, "sm1", "submenu example", level_1_block)	// Example of submenu declaration
+SHELL_PFS_REGISTER(root_block, "led", "toggles the blue LED", command_led_toggle)
+SHELL_PFS_REGISTER(root_block, "flash N", "flash the LED 'N' times", command_flash)
+SHELL_PFS_REGISTER(root_block, "cnt", "displays its own call count", command_cnt)
+SHELL_PFS_REGISTER(root_block, "load", "performance test", command_load)
+SHELL_PFS_REGISTER(root_block, "stream [N]", "stream N telemetry samples", command_stream)
+SHELL_PFS_REGISTER_MENU(root_block, "bench", "benchmarks", bench_block_menu)
+SHELL_PFS_REGISTER(root_block, "bg CMD", "run a command in the background", command_bg)
+SHELL_PFS_REGISTER(root_block, "jobs", "list background jobs", command_jobs)
+SHELL_PFS_REGISTER(root_block, "kill N", "stop a background job", command_kill)
+SHELL_PFS_REGISTER(root_block, "prof", "command execution profile", command_prof)
+SHELL_PFS_REGISTER(root_block, "budget [US]", "step time budget", command_budget)
+SHELL_PFS_REGISTER(root_block, "bin", "binary protocol mode", command_bin)
+SHELL_PFS_REGISTER(root_block, "hist", "command history", command_hist)
+SHELL_PFS_REGISTER(root_block, "mem", "memory footprint", command_mem)
+SHELL_PFS_REGISTER(root_block, "do CMD ; CMD", "run several commands", command_do)
+SHELL_PFS_REGISTER(root_block, "script [NAME]", "run a stored script", command_script)
+SHELL_PFS_REGISTER(root_block, "peek ADDR [b|h|w]", "read memory", command_peek)
+SHELL_PFS_REGISTER(root_block, "poke ADDR VAL [b|h|w]", "write memory", command_poke)
+SHELL_PFS_REGISTER(root_block, "dump ADDR LEN [b|h|w]", "dump memory", command_dump)
+SHELL_PFS_REGISTER(root_block, "link [NAME]", "links for bulk output", command_link)
+SHELL_PFS_REGISTER(root_block, "zip on|off", "compressed output", command_zip)
+SHELL_PFS_REGISTER(root_block, "table [N]", "table of values", command_table)
+SHELL_PFS_REGISTER(root_block, "trace", "event trace", command_trace)
+
+// Lookup indexes for the blocks above (optional, see shell_pfs_lookup)
+SHELL_PFS_INDEX_LINKED(bench_block_menu, 8)
+SHELL_PFS_INDEX_LINKED(level_2_block, 4)
+SHELL_PFS_INDEX_LINKED(level_1_block, 4)
+SHELL_PFS_INDEX_LINKED(root_block, 32)
+
+// Every index, for completion in submenus (see shell_pfs_complete)
+t_shell_pfs_index* shell_pfs_indexes[] = {&root_block_index, &level_1_block_index, &level_2_block_index, &bench_block_menu_index, 0};
+
+// RAM used by the PFS services, as built (see command_mem)
+const t_mem_item shell_pfs_mem_items[] =
+{
+		{"output queue", sizeof (shell_pfs_out_ring)},
+		{"jobs", sizeof (shell_pfs_jobs) + SHELL_PFS_JOB_LINE},		// with the copy of a job's line for its ARGS
+		{"contexts", sizeof (shell_pfs_ctx_pool)},
+		{"binary mode", sizeof (bin_rx) + sizeof (bin_req) + sizeof (bin_resp) + sizeof (bin_tx) + sizeof (bin_job)},
+#ifdef SHELL_PFS_LINKS
+		{"streaming", sizeof (stream_buf)},
+#endif
+#ifdef SHELL_PFS_RX
+		{"input", sizeof (rx_dma) + sizeof (rx_ring) + sizeof (rx_queue) + sizeof (rx_prompt)},
+#endif
+#ifdef SHELL_PFS_RX
+		{"history", sizeof (hist_lines)},
+#endif
+		{"sequences", sizeof (run_job) + sizeof (run_buf)},
+#ifdef SHELL_PFS_TRACE
+		{"trace", sizeof (shell_pfs_trace_buf)},
+#endif
+#ifdef SHELL_PFS_LINKS
+		{"compression", sizeof (zip_in) + sizeof (zip_out) + sizeof (zip_tx) + sizeof (zip_head)},
+#endif
+		{"benchmarks", sizeof (bench_block) + sizeof (bench_names) + sizeof (bench_keys)},
+		{0, 0}
 };
 
+// Stored scripts (see command_script)
+const t_shell_pfs_script shell_pfs_scripts[] =
+{
+		{"demo", "led ; flash 2 ; led ; cnt"},
+		{"load", "sm1 load ; sm1 sm2 load"},
+		{0, 0}
+};
 
+// Commands done in one call (ending with DONE), run inline by sequences and at the prompt (see shell_pfs_is_immediate)
+void (* const shell_pfs_immediate[]) () = {command_led_toggle, 0};
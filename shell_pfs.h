@@ -0,0 +1,81 @@
+/*
+ * shell_pfs.h
+ *
+ * Application interface of the PFS (shell_pfs.c) : the functions main.c, the interrupt callbacks and the
+ * RTOS task call. Each hook is declared with the option that enables it (see shell_pfs.c for the options).
+ *
+ *  Copyright 2022 Jean Roch
+ *
+ *  This file is part of STM Shell.
+ *
+ *  STM Shell is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  STM Shell is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with STM Shell.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHELL_PFS_H_
+#define SHELL_PFS_H_
+
+#include "shell.h"
+#include "main.h"	// For the HAL types
+
+#include <stdint.h>
+
+// Command tables : define SHELL_PFS_FLASH_TABLES to declare them const, so they stay in flash instead of
+// being copied to RAM at startup. The shell library must declare root_block the same way.
+#ifdef SHELL_PFS_FLASH_TABLES
+#define SHELL_PFS_TABLE const
+#else
+#define SHELL_PFS_TABLE
+#endif
+
+extern SHELL_PFS_TABLE t_shell_block_entry root_block[];	// Root of the command tree, for the shell
+
+// Main loop : shell_pfs_init once, then shell_pfs_poll after each call to shell_fp
+void shell_pfs_init ();
+void shell_pfs_poll ();
+
+// Low-power idle (see "Low-power idle")
+#define SHELL_PFS_WAIT_FOREVER 0xFFFFFFFF	// Only input can give the shell work
+
+#define SHELL_PFS_ACTIVE	0		// Something is runnable : poll again
+#define SHELL_PFS_LIGHT		1		// Waiting for a transfer or a deadline : WFI only
+#define SHELL_PFS_DEEP		2		// Waiting for input or a deadline : STOP is allowed
+
+uint32_t shell_pfs_wait_time ();			// ms the shell can wait before its next step
+int shell_pfs_idle_state (uint32_t* ms);	// How deeply the MCU can sleep, and for how long
+void shell_pfs_idle ();						// Sleep until the shell has work
+
+// Watchdog (see "Watchdog") : non-zero while the main loop and the running command make progress
+int shell_pfs_healthy ();
+
+// Binary mode : feed a received byte (can be called from an interrupt)
+void shell_pfs_bin_rx (uint8_t c);
+
+#ifdef SHELL_PFS_UART
+// Streaming : call from HAL_UART_TxCpltCallback without USE_HAL_UART_REGISTER_CALLBACKS.
+// Returns 0 if the interrupt wasn't the stream's.
+int shell_pfs_stream_tx_cplt (UART_HandleTypeDef* huart);
+#endif
+
+#ifdef SHELL_PFS_RX
+// UART reception event (interrupt), already called from HAL_UARTEx_RxEventCallback
+void shell_pfs_rx_event (UART_HandleTypeDef* huart, uint16_t pos);
+#endif
+
+#if defined (SHELL_PFS_RX) && defined (SHELL_PFS_USB_CDC)
+void shell_pfs_usb_rx (uint8_t* buf, uint32_t len);	// USB input (binary mode) : call from CDC_Receive_FS
+#endif
+
+#ifdef SHELL_PFS_RTOS
+void shell_pfs_task (void* arg);			// Shell task, created after shell_pfs_init
+void shell_pfs_tx_done ();					// Call from HAL_UART_TxCpltCallback (interrupt)
+void shell_pfs_rtos_notify (uint32_t flags);
+#endif
+
+#endif /* SHELL_PFS_H_ */